@@ -0,0 +1,193 @@
+/**
+* @file bench_disjoint.cpp
+* @brief Microbenchmark of DisJoint against UnionFind on the edge stream of a real
+*        segmentation: the sorted edges of a depth map are replayed through the
+*        depth-of-field merge, the small component merge and the final labeling
+*/
+
+// System
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// OpenCV
+#include "opencv2/core/core.hpp"
+
+#include "disjoint.h"
+#include "edge_graph.h"
+#include "union_find.h"
+
+//usage: ./bench_disjoint [depth_data.xml] [repetitions]
+//       without a depth file a 640x480 synthetic scene is used
+
+// lens of the default segmenter
+static const double coc_diameter = 0.019;
+static const double aperture_value = 4.0;
+static const double focal_length = 24.0;
+static const int small_thresh = 10;
+
+// keeps the labeling pass from being optimized away
+static volatile int label_sink;
+
+typedef struct StreamTiming
+{
+	double merge_ms;
+	double small_ms;
+	double label_ms;
+	int num_sets;
+} StreamTiming;
+
+/* ************************************************************************* */
+/**
+* @brief:				synthesize a depth map with planes, steps and sensor noise
+* @param  depth_map:	generated depth map (CV_64FC1)
+*/
+static void SynthesizeDepth(cv::Mat& depth_map)
+{
+	depth_map.create(480, 640, CV_64FC1);
+	srand(1);
+	for (int y = 0; y < depth_map.rows; y++) {
+		double* ptr_depth_map = depth_map.ptr<double>(y);
+		for (int x = 0; x < depth_map.cols; x++) {
+			const int block = (x / 80) * 7 + (y / 60) * 13;
+			double value = 600 + (block % 23) * 140 + y * 0.5 + rand() % 5;
+			if (0 == rand() % 40) value = 0;
+			ptr_depth_map[x] = floor(value);
+		}
+	}
+}
+
+/* ************************************************************************* */
+/**
+* @brief:				replay the segmentation edge stream through a disjoint set type
+* @param  depth_map:	depth map the edges were built from
+* @param  graph:		edge graph sorted by weight
+* @return:				timing of each phase
+*/
+template <typename Sets>
+static StreamTiming ReplayEdgeStream(const cv::Mat& depth_map, const EdgeGraph<ushort>& graph)
+{
+	const int width = depth_map.cols;
+	const int num_vertices = depth_map.rows * depth_map.cols;
+	const int num_edges = graph.num_edges();
+	StreamTiming timing;
+
+	Sets d(num_vertices);
+	std::vector<double> component_min(num_vertices), component_max(num_vertices);
+	for (int i = 0; i < num_vertices; i++) {
+		component_min[i] = component_max[i] = depth_map.ptr<double>(i / width)[i % width];
+	}
+
+	int64 tick = cv::getTickCount();
+	for (int i = 0; i < num_edges; i++) {
+		int a = d.find(graph.source(i));
+		int b = d.find(graph.target(i));
+		if (a == b) continue;
+
+		const double minimum = std::min(component_min[a], component_min[b]);
+		const double maximum = std::max(component_max[a], component_max[b]);
+		const double diff = maximum - minimum;
+		const double k = aperture_value * coc_diameter;
+		const double back_dof = k * minimum * minimum / (focal_length * focal_length - k * minimum);
+		const double front_dof = k * maximum * maximum / (focal_length * focal_length + k * maximum);
+		if ((diff < back_dof) || (diff < front_dof)) {
+			d.join(a, b);
+			a = d.find(a);
+			component_min[a] = minimum;
+			component_max[a] = maximum;
+		}
+	}
+	timing.merge_ms = (cv::getTickCount() - tick) * 1000.0 / cv::getTickFrequency();
+
+	tick = cv::getTickCount();
+	for (int i = 0; i < num_edges; i++) {
+		int a = d.find(graph.source(i));
+		int b = d.find(graph.target(i));
+		if ((a != b) && ((d.size(a) < small_thresh) || (d.size(b) < small_thresh))) {
+			d.join(a, b);
+		}
+	}
+	timing.small_ms = (cv::getTickCount() - tick) * 1000.0 / cv::getTickFrequency();
+
+	tick = cv::getTickCount();
+	int checksum = 0;
+	for (int i = 0; i < num_vertices; i++) {
+		checksum ^= d.find(i);
+	}
+	timing.label_ms = (cv::getTickCount() - tick) * 1000.0 / cv::getTickFrequency();
+	label_sink = checksum;
+
+	timing.num_sets = d.num_sets();
+	return timing;
+}
+
+/* ************************************************************************* */
+/**
+* @brief:				run a disjoint set type several times and print the median timing
+* @param  name:			printed name
+* @param  depth_map:	depth map the edges were built from
+* @param  graph:		edge graph sorted by weight
+* @param  repetitions:	number of runs
+* @return:				number of sets after the last run
+*/
+template <typename Sets>
+static int RunBenchmark(const char* name, const cv::Mat& depth_map, const EdgeGraph<ushort>& graph,
+						const int repetitions)
+{
+	std::vector<double> merge_ms, small_ms, label_ms;
+	int num_sets = 0;
+	for (int rep = 0; rep < repetitions; rep++) {
+		StreamTiming timing = ReplayEdgeStream<Sets>(depth_map, graph);
+		merge_ms.push_back(timing.merge_ms);
+		small_ms.push_back(timing.small_ms);
+		label_ms.push_back(timing.label_ms);
+		num_sets = timing.num_sets;
+	}
+	std::sort(merge_ms.begin(), merge_ms.end());
+	std::sort(small_ms.begin(), small_ms.end());
+	std::sort(label_ms.begin(), label_ms.end());
+
+	const int mid = repetitions / 2;
+	printf("%-10s %12.3f %12.3f %12.3f %12.3f %10d\n", name, merge_ms[mid], small_ms[mid], label_ms[mid],
+		   merge_ms[mid] + small_ms[mid] + label_ms[mid], num_sets);
+	return num_sets;
+}
+
+int main(int argc, char* argv[])
+{
+	cv::Mat depth_map;
+	if (argc > 1) {
+		cv::FileStorage depth_data(argv[1], cv::FileStorage::READ);
+		depth_data["data"] >> depth_map;
+		if (depth_map.empty() || CV_64FC1 != depth_map.type()) {
+			printf("Can not read %s\n", argv[1]);
+			return -1;
+		}
+		// same preprocessing as the segmentation input
+		depth_map.convertTo(depth_map, CV_16UC1);
+		depth_map.convertTo(depth_map, CV_64FC1);
+	}
+	else {
+		SynthesizeDepth(depth_map);
+	}
+	const int repetitions = (argc > 2) ? std::max(1, atoi(argv[2])) : 11;
+
+	EdgeGraph<ushort> graph;
+	graph.Build<double>(depth_map);
+	graph.SortByWeight();
+
+	printf("%dx%d depth map, %d edges, %d repetitions (median ms)\n", depth_map.cols, depth_map.rows,
+		   graph.num_edges(), repetitions);
+	printf("%-10s %12s %12s %12s %12s %10s\n", "", "dof merge", "small merge", "labeling", "total", "regions");
+
+	const int disjoint_sets = RunBenchmark<DisJoint>("DisJoint", depth_map, graph, repetitions);
+	const int union_find_sets = RunBenchmark<UnionFind>("UnionFind", depth_map, graph, repetitions);
+	if (disjoint_sets != union_find_sets) {
+		printf("Region count mismatch\n");
+		return -1;
+	}
+
+	return 0;
+}
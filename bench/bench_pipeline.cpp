@@ -0,0 +1,507 @@
+/**
+* @file bench_pipeline.cpp
+* @brief Benchmark of the processing stages on synthetic scenes: depth maps (planes, steps,
+*        noisy ramp) and focus sweeps rendered from them are generated at several sizes, so
+*        no recorded data is needed. Every stage is timed on its own and end to end, the
+*        results are written as JSON
+*/
+
+// System
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// OpenCV
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/videoio.hpp"
+
+#include "align_fill.h"
+#include "depth_reproject.h"
+#include "segment.h"
+#include "select_combine.h"
+#include "work_stealing_pool.h"
+
+//usage: ./bench_pipeline [-s sizes] [-r repetitions] [-n frames] [-o results.json] [-d work_dir] [-k]
+//       sizes:      comma separated list of vga, 1080p, 4k or WxH (default vga,1080p,4k)
+//       -r:         timed runs of every stage after one warm-up run (default 5)
+//       -n:         frames of every focus sweep (default 12)
+//       -o:         JSON output file, - for stdout (default bench_pipeline.json)
+//       -d:         directory of the rendered focus sweeps (default .)
+//       -k:         keep the rendered focus sweeps
+
+// lens of the default segmenter
+static const double coc_diameter = 0.019;
+static const double aperture_value = 4.0;
+static const double focal_length = 24.0;
+static const int small_thresh = 10;
+
+// depth range of the synthetic scenes (mm)
+static const int kNearDepth = 600;
+static const int kFarDepth = 4000;
+
+// blur levels of the focus sweep, level k is a Gaussian of sigma k * kBlurStep
+static const int kBlurLevels = 6;
+static const double kBlurStep = 1.5;
+
+enum SceneKind
+{
+	SCENE_PLANES = 0,		// tilted box in front of a wall above a receding floor
+	SCENE_STEPS = 1,		// vertical bands of constant depth
+	SCENE_NOISY_RAMP = 2,	// diagonal ramp with sensor noise
+	NUM_SCENES = 3
+};
+
+static const char* const kSceneNames[NUM_SCENES] = { "planes", "steps", "noisy_ramp" };
+
+typedef struct BenchSize
+{
+	std::string name;
+	int width;
+	int height;
+} BenchSize;
+
+typedef struct StageTiming
+{
+	const char* name;
+	double median_ms;
+	double min_ms;
+	double max_ms;
+} StageTiming;
+
+typedef struct SceneTiming
+{
+	BenchSize size;
+	int scene;
+	int num_regions;
+	std::vector<StageTiming> stages;
+} SceneTiming;
+
+/* ************************************************************************* */
+/**
+* @brief:				milliseconds since a tick count
+* @param  start:		tick count
+* @return:				elapsed milliseconds
+*/
+static double ElapsedMs(const int64 start)
+{
+	return (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+}
+
+/* ************************************************************************* */
+/**
+* @brief:				parse a comma separated list of sizes
+* @param  list:			vga, 1080p, 4k or WxH entries
+* @param  sizes:		parsed sizes
+* @return:				0 success; 1 unknown entry
+*/
+static int ParseSizes(const std::string& list, std::vector<BenchSize>& sizes)
+{
+	sizes.clear();
+	size_t start = 0;
+	while (start <= list.size())
+	{
+		const size_t end = std::min(list.find(',', start), list.size());
+		BenchSize size;
+		size.name = list.substr(start, end - start);
+		if ("vga" == size.name) { size.width = 640; size.height = 480; }
+		else if ("1080p" == size.name) { size.width = 1920; size.height = 1080; }
+		else if ("4k" == size.name) { size.width = 3840; size.height = 2160; }
+		else if (2 != sscanf(size.name.c_str(), "%dx%d", &size.width, &size.height) ||
+				 size.width < 8 || size.height < 8)
+		{
+			return 1;
+		}
+		sizes.push_back(size);
+		start = end + 1;
+	}
+
+	return 0;
+}
+
+/* ************************************************************************* */
+/**
+* @brief:				synthesize a depth map. Sensor dropouts (depth 0) are scattered over it and
+*						punched along the depth discontinuities, as the sensor loses them there
+* @param  scene:		scene kind
+* @param  size:			depth map size
+* @param  depth_map:	generated depth map (CV_16UC1, mm)
+*/
+static void SynthesizeDepth(const int scene, const cv::Size& size, cv::Mat& depth_map)
+{
+	std::mt19937 rng(1 + scene);
+	std::normal_distribution<double> noise(0.0, 8.0);
+	std::uniform_int_distribution<int> dropout(0, 99);
+
+	const int width = size.width;
+	const int height = size.height;
+	const int range = kFarDepth - kNearDepth;
+	depth_map.create(height, width, CV_16UC1);
+	for (int y = 0; y < height; y++) {
+		ushort* ptr_depth_map = depth_map.ptr<ushort>(y);
+		for (int x = 0; x < width; x++) {
+			const double u = static_cast<double>(x) / width;
+			const double v = static_cast<double>(y) / height;
+			double value = 0;
+			bool edge = false;
+			switch (scene)
+			{
+			case SCENE_PLANES:
+				if (u > 0.3 && u < 0.7 && v > 0.25 && v < 0.65) {
+					value = kNearDepth + 0.15 * range + 0.25 * range * (u - 0.3);
+					edge = (u < 0.31 || u > 0.69 || v < 0.26 || v > 0.64);
+				}
+				else if (v > 0.6) {
+					value = kFarDepth - range * (v - 0.6) / 0.4 * 0.9;
+				}
+				else {
+					value = kFarDepth;
+				}
+				break;
+			case SCENE_STEPS:
+			{
+				const int step = std::min(5, static_cast<int>(u * 6));
+				value = kNearDepth + range * step / 5.0;
+				edge = (u * 6 - step) < 0.02 && step > 0;
+				break;
+			}
+			default:
+				value = kNearDepth + range * (u + v) / 2 + noise(rng);
+				break;
+			}
+
+			if (edge || 0 == dropout(rng)) {
+				value = 0;
+			}
+			ptr_depth_map[x] = cv::saturate_cast<ushort>(value);
+		}
+	}
+}
+
+/* ************************************************************************* */
+/**
+* @brief:				synthesize a textured all-in-focus image of the scene
+* @param  size:			image size
+* @param  texture:		generated image (CV_8UC3)
+*/
+static void SynthesizeTexture(const cv::Size& size, cv::Mat& texture)
+{
+	std::mt19937 rng(7);
+	std::uniform_int_distribution<int> grain(0, 63);
+
+	// checkers of several sizes give every focus measure something to respond to
+	texture.create(size, CV_8UC3);
+	for (int y = 0; y < size.height; y++) {
+		cv::Vec3b* ptr_texture = texture.ptr<cv::Vec3b>(y);
+		for (int x = 0; x < size.width; x++) {
+			const int fine = ((x / 4) + (y / 4)) & 1;
+			const int coarse = ((x / 32) + (y / 32)) & 1;
+			const int base = 64 + 96 * fine + 32 * coarse;
+			for (int c = 0; c < 3; c++) {
+				ptr_texture[x][c] = cv::saturate_cast<uchar>(base + grain(rng) - 32 + 16 * c);
+			}
+		}
+	}
+}
+
+/* ************************************************************************* */
+/**
+* @brief:				render a focus sweep of a scene: every frame focuses on another distance
+*						and every pixel is blurred by its thin lens defocus, |1/d - 1/focus|
+* @param  depth_map:	depth of the scene (CV_16UC1) in the orientation of the video frames
+* @param  num_frames:	number of frames
+* @param  file_name:	video file
+* @return:				0 success; 1 failure
+*/
+static int RenderFocusSweep(const cv::Mat& depth_map, const int num_frames, const std::string& file_name)
+{
+	cv::Mat texture;
+	SynthesizeTexture(depth_map.size(), texture);
+
+	std::vector<cv::Mat> blurred(kBlurLevels);
+	blurred[0] = texture;
+	for (int level = 1; level < kBlurLevels; level++) {
+		cv::GaussianBlur(texture, blurred[level], cv::Size(0, 0), level * kBlurStep);
+	}
+
+	cv::VideoWriter video(file_name, cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), 25, depth_map.size());
+	if (!video.isOpened())
+	{
+		return 1;
+	}
+
+	// focus distances are spaced evenly in diopters, as a focus ring sweeps them
+	const double near_power = 1.0 / kNearDepth;
+	const double far_power = 1.0 / kFarDepth;
+	cv::Mat frame(depth_map.size(), CV_8UC3);
+	for (int idx = 0; idx < num_frames; idx++) {
+		const double focus_power = near_power + (far_power - near_power) * idx / std::max(1, num_frames - 1);
+		for (int y = 0; y < depth_map.rows; y++) {
+			const ushort* ptr_depth_map = depth_map.ptr<ushort>(y);
+			cv::Vec3b* ptr_frame = frame.ptr<cv::Vec3b>(y);
+			for (int x = 0; x < depth_map.cols; x++) {
+				// dropouts are rendered as background
+				const int depth = (ptr_depth_map[x] > 0) ? ptr_depth_map[x] : kFarDepth;
+				const double defocus = std::fabs(1.0 / depth - focus_power) / (near_power - far_power);
+				const int level = std::min(kBlurLevels - 1, static_cast<int>(defocus * (kBlurLevels - 1) + 0.5));
+				ptr_frame[x] = blurred[level].ptr<cv::Vec3b>(y)[x];
+			}
+		}
+		video.write(frame);
+	}
+	video.release();
+
+	return 0;
+}
+
+/* ************************************************************************* */
+/**
+* @brief:				run a stage once to warm it up and then time it
+* @param  name:			stage name
+* @param  repetitions:	timed runs
+* @param  stage:		returns 0 on success
+* @param  timing:		median, minimum and maximum of the timed runs
+* @return:				0 success; 1 the stage failed
+*/
+template <typename Stage>
+static int TimeStage(const char* name, const int repetitions, Stage stage, StageTiming& timing)
+{
+	if (0 != stage())
+	{
+		return 1;
+	}
+
+	std::vector<double> samples;
+	for (int rep = 0; rep < repetitions; rep++) {
+		const int64 start = cv::getTickCount();
+		if (0 != stage())
+		{
+			return 1;
+		}
+		samples.push_back(ElapsedMs(start));
+	}
+	std::sort(samples.begin(), samples.end());
+
+	timing.name = name;
+	timing.median_ms = samples[samples.size() / 2];
+	timing.min_ms = samples.front();
+	timing.max_ms = samples.back();
+
+	return 0;
+}
+
+/* ************************************************************************* */
+/**
+* @brief:				benchmark every stage on one synthetic scene
+* @param  size:			scene size
+* @param  scene:		scene kind
+* @param  repetitions:	timed runs of every stage
+* @param  num_frames:	frames of the focus sweep
+* @param  work_dir:		directory of the rendered focus sweep
+* @param  keep_video:	keep the focus sweep after the run
+* @param  result:		timings
+* @return:				0 success; 1 failure
+*/
+static int BenchScene(const BenchSize& size, const int scene, const int repetitions, const int num_frames,
+					  const std::string& work_dir, const bool keep_video, SceneTiming& result)
+{
+	result.size = size;
+	result.scene = scene;
+	result.num_regions = 0;
+	result.stages.clear();
+
+	cv::Mat depth;
+	SynthesizeDepth(scene, cv::Size(size.width, size.height), depth);
+
+	// the frames are taken by the color camera, so they are rendered from the aligned map,
+	// mirrored horizontally like the labels the segmentation of that map gives
+	cv::Mat aligned, flipped_aligned;
+	if (0 != AlignDepthWithColor(depth, aligned))
+	{
+		fprintf(stderr, "%s %s: cannot align the depth\n", size.name.c_str(), kSceneNames[scene]);
+		return 1;
+	}
+	cv::flip(aligned, flipped_aligned, 1);
+	const std::string video_file = work_dir + "/bench_" + size.name + "_" + kSceneNames[scene] + ".avi";
+	if (0 != RenderFocusSweep(flipped_aligned, num_frames, video_file))
+	{
+		fprintf(stderr, "Cannot write %s\n", video_file.c_str());
+		return 1;
+	}
+
+	// the map align fills: the reprojected depth dilated by a 3x3 rectangle, as in AlignDepthWithColor
+	DepthReprojector reprojector;
+	cv::Mat reprojected, dilated;
+	if (0 != reprojector.Reproject(depth, reprojected, REPROJECT_LAST_WRITE))
+	{
+		fprintf(stderr, "%s %s: cannot reproject the depth\n", size.name.c_str(), kSceneNames[scene]);
+		return 1;
+	}
+	cv::dilate(reprojected, dilated, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3)));
+
+	GraphBasedImageSeg seger(coc_diameter, aperture_value, focal_length);
+	const FusionOptions options = GetDefaultFusionOptions();
+	cv::Mat filled, labels, dst_color, all_in_focus_img;
+	std::vector<RegionInfo> region_info;
+	std::vector<int> best_frames;
+	int num_regions = 0;
+
+	StageTiming timing;
+	int status = TimeStage("align", repetitions, [&]()
+	{
+		return AlignDepthWithColor(depth, aligned);
+	}, timing);
+	if (0 == status)
+	{
+		result.stages.push_back(timing);
+		// the share of align that fills the holes
+		status = TimeStage("fill", repetitions, [&]()
+		{
+			return FillDepthHoles(dilated, filled);
+		}, timing);
+	}
+	if (0 == status)
+	{
+		result.stages.push_back(timing);
+		status = TimeStage("segment", repetitions, [&]()
+		{
+			// the aligned map, as end_to_end and the scene pipeline segment it
+			num_regions = seger.GraphSegment(aligned, small_thresh, labels, region_info, dst_color);
+			return (num_regions > 0) ? 0 : 1;
+		}, timing);
+	}
+	if (0 == status)
+	{
+		result.stages.push_back(timing);
+		result.num_regions = num_regions;
+		status = TimeStage("fuse", repetitions, [&]()
+		{
+			return ConstructAllInFocusImage(labels, num_regions, video_file, options, all_in_focus_img, best_frames);
+		}, timing);
+	}
+	if (0 == status)
+	{
+		result.stages.push_back(timing);
+		status = TimeStage("end_to_end", repetitions, [&]()
+		{
+			if (0 != AlignDepthWithColor(depth, aligned))
+			{
+				return 1;
+			}
+			const int regions = seger.GraphSegment(aligned, small_thresh, labels, region_info, dst_color);
+			if (regions <= 0)
+			{
+				return 1;
+			}
+			return ConstructAllInFocusImage(labels, regions, video_file, options, all_in_focus_img, best_frames);
+		}, timing);
+	}
+	if (0 == status)
+	{
+		result.stages.push_back(timing);
+	}
+	else
+	{
+		fprintf(stderr, "%s %s: stage %d failed\n", size.name.c_str(), kSceneNames[scene],
+				static_cast<int>(result.stages.size()));
+	}
+
+	if (!keep_video)
+	{
+		remove(video_file.c_str());
+	}
+
+	return status;
+}
+
+/* ************************************************************************* */
+/**
+* @brief:				write the timings as JSON
+* @param  out:			output stream
+* @param  repetitions:	timed runs of every stage
+* @param  num_frames:	frames of every focus sweep
+* @param  results:		timings of every scene
+*/
+static void WriteJson(FILE* out, const int repetitions, const int num_frames, const std::vector<SceneTiming>& results)
+{
+	fprintf(out, "{\n");
+	fprintf(out, "  \"benchmark\": \"bench_pipeline\",\n");
+	fprintf(out, "  \"threads\": %d,\n", GetParallelThreads());
+	fprintf(out, "  \"repetitions\": %d,\n", repetitions);
+	fprintf(out, "  \"frames\": %d,\n", num_frames);
+	fprintf(out, "  \"results\": [");
+	for (size_t i = 0; i < results.size(); i++) {
+		const SceneTiming& result = results[i];
+		fprintf(out, "%s\n    {\n", (i > 0) ? "," : "");
+		fprintf(out, "      \"size\": \"%s\", \"width\": %d, \"height\": %d,\n", result.size.name.c_str(),
+				result.size.width, result.size.height);
+		fprintf(out, "      \"scene\": \"%s\", \"regions\": %d,\n", kSceneNames[result.scene], result.num_regions);
+		fprintf(out, "      \"stages\": {");
+		for (size_t k = 0; k < result.stages.size(); k++) {
+			const StageTiming& stage = result.stages[k];
+			fprintf(out, "%s\n        \"%s\": { \"median_ms\": %.3f, \"min_ms\": %.3f, \"max_ms\": %.3f }",
+					(k > 0) ? "," : "", stage.name, stage.median_ms, stage.min_ms, stage.max_ms);
+		}
+		fprintf(out, "\n      }\n    }");
+	}
+	fprintf(out, "\n  ]\n}\n");
+}
+
+int main(int argc, char* argv[])
+{
+	std::string size_list = "vga,1080p,4k";
+	std::string output_file = "bench_pipeline.json";
+	std::string work_dir = ".";
+	int repetitions = 5;
+	int num_frames = 12;
+	bool keep_video = false;
+	for (int i = 1; i < argc; i++) {
+		if (0 == strcmp(argv[i], "-s") && i + 1 < argc) size_list = argv[++i];
+		else if (0 == strcmp(argv[i], "-r") && i + 1 < argc) repetitions = std::max(1, atoi(argv[++i]));
+		else if (0 == strcmp(argv[i], "-n") && i + 1 < argc) num_frames = std::max(2, atoi(argv[++i]));
+		else if (0 == strcmp(argv[i], "-o") && i + 1 < argc) output_file = argv[++i];
+		else if (0 == strcmp(argv[i], "-d") && i + 1 < argc) work_dir = argv[++i];
+		else if (0 == strcmp(argv[i], "-k")) keep_video = true;
+		else {
+			fprintf(stderr, "Unknown argument %s\n", argv[i]);
+			return -1;
+		}
+	}
+
+	std::vector<BenchSize> sizes;
+	if (0 != ParseSizes(size_list, sizes))
+	{
+		fprintf(stderr, "Invalid size list %s\n", size_list.c_str());
+		return -1;
+	}
+
+	std::vector<SceneTiming> results;
+	int failures = 0;
+	for (size_t i = 0; i < sizes.size(); i++) {
+		for (int scene = 0; scene < NUM_SCENES; scene++) {
+			fprintf(stderr, "%s %s\n", sizes[i].name.c_str(), kSceneNames[scene]);
+			SceneTiming result;
+			failures += BenchScene(sizes[i], scene, repetitions, num_frames, work_dir, keep_video, result);
+			results.push_back(result);
+		}
+	}
+
+	FILE* out = ("-" == output_file) ? stdout : fopen(output_file.c_str(), "w");
+	if (!out)
+	{
+		fprintf(stderr, "Cannot write %s\n", output_file.c_str());
+		return -1;
+	}
+	WriteJson(out, repetitions, num_frames, results);
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+
+	return failures ? -1 : 0;
+}
@@ -18,9 +18,10 @@ int AlignDepthWithColor(const cv::Mat& src_depth, cv::Mat& aligned_depth);
 * @brief:                       fill depth holes based on anisotropic diffusion method  
 * @param  src_depth:            original depth map
 * @param  filled_depth:         filled depth map 
+* @param  iterations:           number of diffusion passes, more passes give denser fills
 * @return:                      0 success; 1 failure
 */
-int FillDepthHoles(const cv::Mat& src_depth, cv::Mat& filled_depth);
+int FillDepthHoles(const cv::Mat& src_depth, cv::Mat& filled_depth, const int iterations = 1);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,105 @@
+/**
+* @file concurrent_union_find.h
+* @brief Lock-free disjoint set forest for merging segments from several threads
+*/
+
+#ifndef CONCURRENT_UNION_FIND_H_
+#define CONCURRENT_UNION_FIND_H_
+
+#include <atomic>
+#include <memory>
+
+#include "union_find.h"
+
+/* ************************************************************************* */
+/**
+* @brief Disjoint set forest whose find and unite may run concurrently. Roots point
+*        to themselves and are only ever changed by a compare-and-swap, a root is
+*        always linked below the root with the smaller index, so no cycle can form.
+*        find halves paths with compare-and-swap as well, failed attempts are simply
+*        skipped because another thread already moved the node closer to its root.
+*/
+class ConcurrentUnionFind{
+public:
+	ConcurrentUnionFind(int elements = 0);
+	~ConcurrentUnionFind();
+
+	/* ************************************************************************* */
+	/**
+	* @brief		start over with singleton sets, storage is only reallocated to grow
+	* @param elements	number of elements
+	*/
+	void Reset(int elements);
+
+	/* ************************************************************************* */
+	/**
+	* @brief		copy the forest of a serial union-find
+	* @param sets	union-find with the same number of elements
+	*/
+	void Assign(const UnionFind& sets);
+
+	/* ************************************************************************* */
+	/**
+	* @brief		write the forest back into a serial union-find, every element then
+	*				points directly to its root and the sizes are recomputed
+	* @param sets	union-find with the same number of elements
+	*/
+	void Export(UnionFind& sets);
+
+	/* ************************************************************************* */
+	/**
+	* @brief	Locate the root of x, safe against concurrent unions
+	* @param x	Element
+	* @return	Root of x at some point during the call
+	*/
+	int find(int x)
+	{
+		for (;;) {
+			int p = parent[x].load(std::memory_order_acquire);
+			if (p == x) {
+				return x;
+			}
+			int gp = parent[p].load(std::memory_order_acquire);
+			if (gp == p) {
+				return p;
+			}
+			parent[x].compare_exchange_weak(p, gp, std::memory_order_acq_rel);
+			x = gp;
+		}
+	}
+
+	/* ************************************************************************* */
+	/**
+	* @brief	Link root x below root y if both are still roots
+	* @param x	Root to be linked, must have the larger index
+	* @param y	New parent
+	* @return	true if the link happened, false if x stopped being a root
+	*/
+	bool link_root(int x, int y)
+	{
+		int expected = x;
+		return parent[x].compare_exchange_strong(expected, y, std::memory_order_acq_rel);
+	}
+
+	/* ************************************************************************* */
+	/**
+	* @brief	Check whether x is a root
+	* @param x	Element
+	* @return	true if x is a root at the time of the call
+	*/
+	bool is_root(int x) const { return parent[x].load(std::memory_order_acquire) == x; }
+
+	/* ************************************************************************* */
+	/**
+	* @brief	Get the number of elements
+	* @return	Number of elements
+	*/
+	int num_elements() const { return num; }
+
+private:
+	std::unique_ptr<std::atomic<int>[]> parent;
+	int num;
+	int capacity;
+};
+
+#endif
@@ -0,0 +1,118 @@
+/**
+* @file depth_io.h
+* @brief Compact binary container of 16-bit depth maps, read through a memory mapping
+*/
+
+#ifndef DEPTH_IO_H_
+#define DEPTH_IO_H_
+
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+/*
+    Layout (little endian):
+        DepthFileHeader
+        padding up to data_offset
+        num_frames frames of rows x cols uint16 depth values (mm), row-major, no row padding
+*/
+
+#define DEPTH_FILE_MAGIC		"DPTH"
+#define DEPTH_FILE_VERSION		1
+// frames start on a cache line
+#define DEPTH_FILE_DATA_OFFSET	64
+
+typedef struct DepthFileHeader
+{
+	char magic[4];			// DEPTH_FILE_MAGIC
+	unsigned int version;	// DEPTH_FILE_VERSION
+	unsigned int rows;
+	unsigned int cols;
+	unsigned int num_frames;
+	unsigned int data_offset;	// bytes from the start of the file to the first frame
+} DepthFileHeader;
+
+/* ************************************************************************* */
+/**
+* @brief:                       write depth maps into a depth file
+* @param  file_name:            depth file
+* @param  frames:               depth maps (CV_16UC1) of the same size
+* @return:                      0 success; 1 failure
+*/
+int WriteDepthFile(const std::string& file_name, const std::vector<cv::Mat>& frames);
+
+/* ************************************************************************* */
+/**
+* @brief Read-only view of a depth file. The file is mapped copy-on-write, so frames are
+*        cv::Mat headers on the mapping and nothing is copied; writing to a frame only
+*        changes the private pages of this process
+*/
+class DepthFile{
+public:
+	DepthFile();
+	~DepthFile();
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   map a depth file, a previously opened file is closed
+	* @param  file_name:        depth file
+	* @return:                  0 success; 1 failure (missing file, not a depth file or truncated)
+	*/
+	int Open(const std::string& file_name);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   unmap the file, frames obtained before must not be used afterwards
+	*/
+	void Close();
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   get a frame without copying it
+	* @param  idx:              frame index
+	* @return:                  depth map (CV_16UC1) on the mapping, empty if idx is out of range
+	*/
+	cv::Mat frame(const int idx) const;
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   get the number of frames
+	* @return:                  number of frames, 0 if no file is open
+	*/
+	int num_frames() const { return frames; }
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   get the size of the frames
+	* @return:                  frame size
+	*/
+	cv::Size size() const { return frame_size; }
+
+private:
+	DepthFile(const DepthFile&);
+	DepthFile& operator=(const DepthFile&);
+
+	void* mapping;
+	size_t mapping_size;
+#if defined(_WIN32)
+	void* file_handle;
+	void* mapping_handle;
+#endif
+	int frames;
+	cv::Size frame_size;
+	size_t data_offset;
+};
+
+/* ************************************************************************* */
+/**
+* @brief:                       load a 16-bit depth map, mapped from a depth file or parsed from a
+*                               FileStorage XML file holding a CV_64F map under "data"
+* @param  file_name:            depth file or XML file
+* @param  depth_file:           keeps the mapping of a depth file alive, depth refers to it
+* @param  depth:                first depth map (CV_16UC1)
+* @return:                      0 success; 1 failure
+*/
+int LoadDepthMap(const std::string& file_name, DepthFile& depth_file, cv::Mat& depth);
+
+#endif
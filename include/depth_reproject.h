@@ -0,0 +1,98 @@
+#ifndef DEPTH_REPROJECT_H_
+#define DEPTH_REPROJECT_H_
+
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+/* ************************************************************************* */
+/**
+* @brief Intrinsic parameters of both cameras and the extrinsic transform that
+*        maps points from the depth sensor frame into the color camera frame
+*/
+typedef struct RigCalibration
+{
+	// depth sensor (Kinect)
+	double depth_fx, depth_fy;
+	double depth_u0, depth_v0;
+	// color camera (Pentax)
+	double color_fx, color_fy;
+	double color_u0, color_v0;
+	// extrinsic parameters, rotation is stored row-major
+	double rotation[9];
+	double translation[3];
+} RigCalibration;
+
+// how collisions are resolved when several depth pixels land on one color pixel. Every pixel
+// is projected with the operations of the legacy per-pixel matrix product in the same order,
+// so REPROJECT_LAST_WRITE gives the legacy tmp_depth_for_color bit for bit
+enum ReprojectMode
+{
+	REPROJECT_LAST_WRITE = 0,	// raster order, last pixel wins (legacy collision rule)
+	REPROJECT_Z_BUFFER = 1		// nearest valid depth wins
+};
+
+/* ************************************************************************* */
+/**
+* @brief:                       get the calibration of our Kinect + Pentax rig
+* @return:                      rig calibration
+*/
+RigCalibration GetDefaultRigCalibration(void);
+
+class DepthReprojector{
+public:
+	DepthReprojector(const RigCalibration& calibration = GetDefaultRigCalibration());
+	~DepthReprojector();
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   replace the rig calibration, coefficient tables are rebuilt lazily
+	* @param  calibration:      new rig calibration
+	*/
+	void SetCalibration(const RigCalibration& calibration);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   reproject a depth map into the color camera image plane
+	* @param  src_depth:        original depth map (CV_16UC1)
+	* @param  depth_for_color:  depth map seen from the color camera (CV_16UC1, same size)
+	* @param  mode:             collision handling, see ReprojectMode
+	* @return:                  0 success; 1 failure
+	*/
+	int Reproject(const cv::Mat& src_depth, cv::Mat& depth_for_color,
+				  const int mode = REPROJECT_LAST_WRITE);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   project rows [row_begin, row_end) of src_depth into the target buffers
+	* @param  src_depth:        original depth map
+	* @param  row_begin:        first row
+	* @param  row_end:          one past the last row
+	*/
+	void ProjectRows(const cv::Mat& src_depth, const int row_begin, const int row_end);
+
+private:
+	/* ************************************************************************* */
+	/**
+	* @brief:                   tabulate the column and row offsets from the depth principal point
+	* @param  width:            depth map width
+	* @param  height:           depth map height
+	*/
+	void BuildTables(const int width, const int height);
+
+private:
+	RigCalibration calib;
+	int table_width;
+	int table_height;
+
+	// col_idx - depth_u0 and row_idx - depth_v0. Folding more of the calibration into the
+	// tables would reorder the arithmetic and change the rounding
+	std::vector<double> col_offset;
+	std::vector<double> row_offset;
+
+	// color pixel index each depth pixel projects to and its depth seen from the color camera
+	std::vector<int> target_idx;
+	std::vector<ushort> target_depth;
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef DIAGNOSTICS_H_
+#define DIAGNOSTICS_H_
+
+#include <string>
+
+#include "opencv2/core/core.hpp"
+
+/*
+    Debug images are produced only when the verbosity level asks for them and are
+    encoded by a background writer thread, so the processing stages never wait on
+    JPEG encoding. Building with -DDIAG_HEADLESS removes every GUI call at compile
+    time; SetDiagHeadless(true) does the same at run time.
+*/
+
+// verbosity levels, a message is emitted when its level <= current level
+enum DiagLevel
+{
+	DIAG_OFF = 0,		// no diagnostics at all (default)
+	DIAG_INFO = 1,		// per-stage results, e.g. the colorized segmentation
+	DIAG_DEBUG = 2		// intermediate images of every stage and interactive windows
+};
+
+/* ************************************************************************* */
+/**
+* @brief:                       set the verbosity level
+* @param  level:                one of DiagLevel
+*/
+void SetDiagLevel(const int level);
+
+/* ************************************************************************* */
+/**
+* @brief:                       get the verbosity level
+* @return:                      current level
+*/
+int GetDiagLevel(void);
+
+/* ************************************************************************* */
+/**
+* @brief:                       check whether diagnostics of the given level are emitted, callers
+*                               should test this before building a debug image
+* @param  level:                level of the diagnostics
+* @return:                      true if enabled
+*/
+bool DiagEnabled(const int level);
+
+/* ************************************************************************* */
+/**
+* @brief:                       enable or disable headless mode, no GUI call is made when enabled
+* @param  headless:             true for headless runs
+*/
+void SetDiagHeadless(const bool headless);
+
+/* ************************************************************************* */
+/**
+* @brief:                       get headless mode
+* @return:                      true if no GUI call may be made
+*/
+bool IsDiagHeadless(void);
+
+/* ************************************************************************* */
+/**
+* @brief:                       set the directory debug images are written to
+* @param  dir:                  output directory, empty for the working directory
+*/
+void SetDiagOutputDir(const std::string& dir);
+
+/* ************************************************************************* */
+/**
+* @brief:                       queue an image to be written by the background writer
+* @param  level:                level of the diagnostics
+* @param  file_name:            file name relative to the output directory
+* @param  img:                  image to be written, it is copied before returning
+* @return:                      0 queued or disabled; 1 failure
+*/
+int DiagWriteImage(const int level, const std::string& file_name, const cv::Mat& img);
+
+/* ************************************************************************* */
+/**
+* @brief:                       show an image in a window, does nothing in headless mode
+* @param  level:                level of the diagnostics
+* @param  window_name:          name of the window
+* @param  img:                  image to be shown
+* @param  delay:                milliseconds to wait for a key, 0 waits forever
+* @return:                      0 success or disabled; 1 failure
+*/
+int DiagShowImage(const int level, const std::string& window_name, const cv::Mat& img,
+				  const int delay);
+
+/* ************************************************************************* */
+/**
+* @brief:                       block until every queued image has been written
+*/
+void DiagFlush(void);
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef EDGE_GRAPH_H_
+#define EDGE_GRAPH_H_
+
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+/*
+    Compact 8-connected edge graph of a depth map. An edge is identified by
+    (source pixel << 2) | direction, the target pixel follows from the direction,
+    so the edge list needs 4 bytes per edge. 16-bit weights are not stored at all:
+    Build recomputes them from the depth map while it counting sorts the edges, so an
+    integral depth map costs 16 bytes per pixel (64 with the old 16-byte Edge structs).
+    Other weights are stored once per edge id as double (48 bytes per pixel).
+*/
+
+// direction of an edge leaving pixel (x, y)
+enum EdgeDirection
+{
+	EDGE_RIGHT = 0,			// to (x + 1, y)
+	EDGE_DOWN = 1,			// to (x, y + 1)
+	EDGE_DOWN_RIGHT = 2,	// to (x + 1, y + 1)
+	EDGE_UP_RIGHT = 3		// to (x + 1, y - 1)
+};
+
+#define EDGE_DIRECTION_BITS		2
+#define EDGE_DIRECTION_MASK		0x3
+
+template <typename WeightT>
+class EdgeGraph{
+public:
+	EdgeGraph();
+	~EdgeGraph();
+
+	/* ************************************************************************* */
+	/**
+	* @brief:				build the edges of a depth map, rows are processed in parallel and the
+	*						edges keep the row-major generation order. 16-bit weights leave the
+	*						edges in the order SortByWeight gives instead
+	* @param  depth_map:	single channel depth map whose element type is PixelT
+	* @return:				number of edges
+	*/
+	template <typename PixelT>
+	int Build(const cv::Mat& depth_map);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:				sort edges by non-decreasing weight, equal weights keep generation order.
+	*						16-bit weights are already sorted by Build, other weights use a
+	*						comparison sort
+	*/
+	void SortByWeight();
+
+	/* ************************************************************************* */
+	/**
+	* @brief:				get the number of edges
+	* @return:				number of edges
+	*/
+	int num_edges() const { return static_cast<int>(edges.size()); }
+
+	/* ************************************************************************* */
+	/**
+	* @brief:				get the source pixel of the idx-th edge
+	* @param  idx:			edge index
+	* @return:				pixel index (y * width + x)
+	*/
+	int source(const int idx) const { return static_cast<int>(edges[idx] >> EDGE_DIRECTION_BITS); }
+
+	/* ************************************************************************* */
+	/**
+	* @brief:				get the target pixel of the idx-th edge
+	* @param  idx:			edge index
+	* @return:				pixel index (y * width + x)
+	*/
+	int target(const int idx) const
+	{
+		return source(idx) + offsets[edges[idx] & EDGE_DIRECTION_MASK];
+	}
+
+public:
+	int width;
+	int height;
+
+	// packed edge ids, in generation order after Build and in weight order after SortByWeight
+	std::vector<unsigned int> edges;
+
+	// weight of every edge id, four slots per pixel (slots of missing edges are unused),
+	// empty for 16-bit weights
+	std::vector<WeightT> weights;
+
+	// pixel index offset of each direction
+	int offsets[4];
+
+private:
+	/* ************************************************************************* */
+	/**
+	* @brief:				generate the edges straight into weight order with a stable (parallel)
+	*						counting sort over row chunks
+	* @param  depth_map:	single channel depth map whose element type is PixelT
+	*/
+	template <typename PixelT>
+	void CountingSortEdges(const cv::Mat& depth_map);
+
+private:
+	// first edge of every row
+	std::vector<int> row_offsets;
+
+	// per chunk histograms and per chunk largest weights of the counting sort
+	std::vector<int> histograms;
+	std::vector<int> chunk_max;
+};
+
+// 16-bit weights are sorted by Build
+template <> void EdgeGraph<ushort>::SortByWeight();
+
+#endif
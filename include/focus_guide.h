@@ -0,0 +1,73 @@
+/**
+* @file focus_guide.h
+* @brief Restrict the focus search of every region to the frames whose depth of field reaches it
+*/
+
+#ifndef FOCUS_GUIDE_H_
+#define FOCUS_GUIDE_H_
+
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+#include "lens.h"
+
+typedef struct DepthRange
+{
+	double min_depth;		// mm, 0 if the region has no valid depth
+	double max_depth;		// mm
+} DepthRange;
+
+/* ************************************************************************* */
+/**
+* @brief:                       get the depth range of every region, pixels without depth (0) are
+*                               ignored
+* @param  depth_map:            depth in mm (single channel), in the coordinates of labels
+* @param  labels:               region id of every pixel (CV_32SC1)
+* @param  num_regions:          number of regions
+* @param  ranges:               depth range of every region, resized and overwritten
+* @return:                      0 success; 1 failure
+*/
+int ComputeRegionDepthRanges(const cv::Mat& depth_map, const cv::Mat& labels, const int num_regions,
+							 std::vector<DepthRange>& ranges);
+
+/* ************************************************************************* */
+/**
+* @brief:                       read the focus distance of every frame from a text sidecar file,
+*                               one distance in mm per line, lines starting with # are skipped
+* @param  file_name:            sidecar file
+* @param  distances:            focus distance of every frame
+* @return:                      0 success; 1 failure
+*/
+int LoadFocusDistances(const std::string& file_name, std::vector<double>& distances);
+
+/* ************************************************************************* */
+/**
+* @brief:                       model a focus sweep moving linearly from near to far
+* @param  near_distance:        focus distance of the first frame (mm)
+* @param  far_distance:         focus distance of the last frame (mm)
+* @param  num_frames:           number of frames of the sweep
+* @param  distances:            focus distance of every frame
+*/
+void MakeLinearFocusSweep(const double near_distance, const double far_distance, const int num_frames,
+						  std::vector<double>& distances);
+
+/* ************************************************************************* */
+/**
+* @brief:                       find the frames whose depth of field overlaps the depth range of
+*                               every region. Regions without such a frame, or without depth, get
+*                               the whole video [0, INT_MAX]
+* @param  lens:                 lens profile
+* @param  distances:            focus distance of every frame
+* @param  ranges:               depth range of every region
+* @param  margin:               frames added on both sides of every window
+* @param  first_frame:          first frame to evaluate for every region
+* @param  last_frame:           last frame to evaluate for every region
+* @return:                      number of regions that fall back to the full search
+*/
+int ComputeFrameWindows(const LensProfile& lens, const std::vector<double>& distances,
+						const std::vector<DepthRange>& ranges, const int margin,
+						std::vector<int>& first_frame, std::vector<int>& last_frame);
+
+#endif
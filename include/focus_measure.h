@@ -0,0 +1,159 @@
+#ifndef FOCUS_MEASURE_H_
+#define FOCUS_MEASURE_H_
+
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+/*
+    Sharpness metrics of the focal stack. Every metric is a policy class turning a row
+    of a gray image into a per-pixel response, which is accumulated per region in
+    64-bit counters, and scoring the accumulated statistics of a region. The drivers
+    are templates over the policy, so the pixel loops are specialized at compile time.
+    Responses of the derivative based metrics are computed with AVX2 or SSE2 when the
+    compiler targets them, borders are replicated.
+*/
+
+typedef struct RegionStatistics
+{
+    int64 count;
+    int64 sum;
+    int64 sum_of_squares;
+} RegionStatistics;
+
+enum FocusMeasureType
+{
+	FOCUS_NORMALIZED_VARIANCE = 0,		// variance / mean of the intensity
+	FOCUS_TENENGRAD = 1,				// mean squared Sobel gradient magnitude
+	FOCUS_LAPLACIAN_VARIANCE = 2,		// variance of the 4-neighbour Laplacian
+	FOCUS_SUM_MODIFIED_LAPLACIAN = 3	// mean modified Laplacian |Lxx| + |Lyy|
+};
+
+/* ************************************************************************* */
+/**
+* @brief Focus measure policies. Response() fills response[0, width) for the row whose
+*        neighbours are up and down, Score() turns the region statistics into a
+*        sharpness value where larger is sharper
+*/
+struct NormalizedVarianceMeasure
+{
+	static const int type = FOCUS_NORMALIZED_VARIANCE;
+	static const bool squares = true;
+	static void Response(const uchar* up, const uchar* row, const uchar* down, const int width, int* response);
+	static float Score(const RegionStatistics& stats);
+};
+
+struct TenengradMeasure
+{
+	static const int type = FOCUS_TENENGRAD;
+	static const bool squares = false;
+	static void Response(const uchar* up, const uchar* row, const uchar* down, const int width, int* response);
+	static float Score(const RegionStatistics& stats);
+};
+
+struct LaplacianVarianceMeasure
+{
+	static const int type = FOCUS_LAPLACIAN_VARIANCE;
+	static const bool squares = true;
+	static void Response(const uchar* up, const uchar* row, const uchar* down, const int width, int* response);
+	static float Score(const RegionStatistics& stats);
+};
+
+struct SumModifiedLaplacianMeasure
+{
+	static const int type = FOCUS_SUM_MODIFIED_LAPLACIAN;
+	static const bool squares = false;
+	static void Response(const uchar* up, const uchar* row, const uchar* down, const int width, int* response);
+	static float Score(const RegionStatistics& stats);
+};
+
+/* ************************************************************************* */
+/**
+* @brief:                       accumulate the response statistics of every region in a single pass
+* @param  gray_img:             image (CV_8UC1)
+* @param  labels:               region id of every pixel (CV_32SC1), ids outside [0, num_regions)
+*                               are ignored
+* @param  num_regions:          number of regions
+* @param  stats:                statistics of every region, resized and overwritten
+* @return:                      0, success; -1 failure
+*/
+template <typename Measure>
+int AccumulateFocusStatistics(const cv::Mat& gray_img, const cv::Mat& labels, const int num_regions,
+							  std::vector<RegionStatistics>& stats);
+
+/* ************************************************************************* */
+/**
+* @brief:                       AccumulateFocusStatistics restricted to some regions and rows, the
+*                               statistics of the other regions stay empty
+* @param  active_regions:       non-zero for every region to be accumulated, NULL for all
+* @param  active_rows:          non-zero for every row to be visited, NULL for all
+*/
+template <typename Measure>
+int AccumulateFocusStatistics(const cv::Mat& gray_img, const cv::Mat& labels, const int num_regions,
+							  const char* active_regions, const char* active_rows,
+							  std::vector<RegionStatistics>& stats);
+
+/* ************************************************************************* */
+/**
+* @brief:                       add the response statistics of a single region inside a rectangle,
+*                               the result equals the full image accumulation restricted to it
+* @param  gray_img:             image (CV_8UC1)
+* @param  labels:               region id of every pixel (CV_32SC1)
+* @param  label:                region to be accumulated
+* @param  roi:                  rectangle containing the region, e.g. its bounding box
+* @param  stats:                statistics of the region, added to
+* @return:                      0, success; -1 failure
+*/
+template <typename Measure>
+int AccumulateRegionFocus(const cv::Mat& gray_img, const cv::Mat& labels, const int label,
+						  const cv::Rect& roi, RegionStatistics& stats);
+
+/* ************************************************************************* */
+/**
+* @brief:                       measure the sharpness of a masked area
+* @param  gray_img:             image (CV_8UC1)
+* @param  mask:                 area to be measured (CV_8UC1, non-zero inside)
+* @return:                      sharpness, 0 for an empty mask
+*/
+template <typename Measure>
+float MeasureFocus(const cv::Mat& gray_img, const cv::Mat& mask);
+
+/* ************************************************************************* */
+/**
+* @brief:                       AccumulateFocusStatistics for a metric chosen at run time, the
+*                               dispatch happens once per image
+* @param  measure:              one of FocusMeasureType
+* @return:                      0, success; -1 failure
+*/
+int AccumulateFocusStatistics(const int measure, const cv::Mat& gray_img, const cv::Mat& labels,
+							  const int num_regions, std::vector<RegionStatistics>& stats);
+
+/* ************************************************************************* */
+/**
+* @brief:                       restricted AccumulateFocusStatistics for a metric chosen at run time
+* @param  measure:              one of FocusMeasureType
+* @return:                      0, success; -1 failure
+*/
+int AccumulateFocusStatistics(const int measure, const cv::Mat& gray_img, const cv::Mat& labels,
+							  const int num_regions, const char* active_regions, const char* active_rows,
+							  std::vector<RegionStatistics>& stats);
+
+/* ************************************************************************* */
+/**
+* @brief:                       AccumulateRegionFocus for a metric chosen at run time
+* @param  measure:              one of FocusMeasureType
+* @return:                      0, success; -1 failure
+*/
+int AccumulateRegionFocus(const int measure, const cv::Mat& gray_img, const cv::Mat& labels,
+						  const int label, const cv::Rect& roi, RegionStatistics& stats);
+
+/* ************************************************************************* */
+/**
+* @brief:                       score of a region for a metric chosen at run time
+* @param  measure:              one of FocusMeasureType
+* @param  stats:                statistics of the region
+* @return:                      sharpness
+*/
+float FocusScore(const int measure, const RegionStatistics& stats);
+
+#endif
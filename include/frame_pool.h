@@ -0,0 +1,101 @@
+#ifndef FRAME_POOL_H_
+#define FRAME_POOL_H_
+
+#include <atomic>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+/*
+    Preallocated image buffers for the fusion stage. Mats handed out by the pool wrap
+    pool memory, so OpenCV functions writing into them with the same size and type do
+    not allocate.
+
+    Allocations are measured rather than inferred from the pool: while a thread is inside
+    an AllocationScope, every allocation reported through CountAllocation is added to the
+    counter of that scope. The library only reports, the allocation hooks are installed by
+    the program that measures, tests/fusion_alloc_test.cpp replaces operator new and the
+    default cv::Mat allocator. The scope is per thread, so engines running at the same
+    time (e.g. batch scenes) only count their own allocations.
+*/
+
+/* ************************************************************************* */
+/**
+* @brief:                       count one allocation of the calling thread into its innermost
+*                               AllocationScope, nothing happens outside of a scope. Meant to be
+*                               called from allocation hooks, it does not allocate itself
+*/
+void CountAllocation(void);
+
+/* ************************************************************************* */
+/**
+* @brief Counts the allocations of the calling thread while it is alive. Scopes nest, the
+*        innermost one counts and the enclosing one counts again once it is left
+*/
+class AllocationScope{
+public:
+	/* ************************************************************************* */
+	/**
+	* @brief:                   start counting into a counter
+	* @param  counter:          counter, null to not count inside the scope
+	*/
+	explicit AllocationScope(std::atomic<int64>* counter);
+	~AllocationScope();
+
+private:
+	AllocationScope(const AllocationScope&);
+	AllocationScope& operator=(const AllocationScope&);
+
+	std::atomic<int64>* previous;
+};
+
+class FramePool{
+public:
+	FramePool();
+	~FramePool();
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   make sure the pool holds count buffers of the given size and type,
+	*                           nothing is allocated if it already does
+	* @param  size:             image size
+	* @param  type:             image type
+	* @param  count:            number of buffers
+	* @return:                  0 success; 1 failure
+	*/
+	int Reserve(const cv::Size size, const int type, const int count);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   get a mat wrapping a pooled buffer, the pool must outlive it
+	* @param  idx:              buffer index
+	* @return:                  mat header
+	*/
+	cv::Mat Get(const int idx);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   check that a mat obtained from Get still uses its pooled buffer.
+	*                           If an OpenCV call reallocated it, the content is moved back into
+	*                           the pool when it fits
+	* @param  mat:              mat obtained from Get(idx)
+	* @param  idx:              buffer index
+	* @return:                  true if the mat still used pooled memory
+	*/
+	bool Track(cv::Mat& mat, const int idx);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   get the number of buffers
+	* @return:                  number of buffers
+	*/
+	int size() const { return static_cast<int>(buffers.size()); }
+
+private:
+	cv::Size buffer_size;
+	int buffer_type;
+	size_t buffer_step;
+	std::vector<std::vector<uchar> > buffers;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef FUSION_ENGINE_H_
+#define FUSION_ENGINE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+#include "focus_measure.h"
+
+/*
+    Pipelined scan of the multi-focus video. A decoder task fills a bounded ring of
+    reusable frame slots, one task per frame converts it to gray and accumulates the
+    per-region statistics in whatever order they finish, and the calling thread reduces
+    the frames strictly in decoding order, so the result does not depend on the
+    scheduling. The tasks run on the WorkStealingPool of the caller, or on a private
+    pool when the caller is not a pool worker, and the caller runs queued tasks while
+    it waits for a frame.
+*/
+
+class FusionEngine{
+public:
+	/* ************************************************************************* */
+	/**
+	* @brief:                   called on the calling thread once per frame, in frame order
+	* @param  frame_idx:        index of the frame in the video
+	* @param  frame:            decoded color frame, only valid during the call
+	* @param  stats:            statistics of every region in this frame, empty if the frame is
+	*                           not selected
+	* @return:                  0 to continue; > 0 to stop the scan; < 0 to fail it
+	*/
+	typedef std::function<int(const int frame_idx, const cv::Mat& frame,
+							  const std::vector<RegionStatistics>& stats)> FrameReducer;
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   create an engine
+	* @param  num_workers:      number of workers of the private pool, 0 for one per spare hardware
+	*                           thread. A run on a shared pool uses its workers instead
+	* @param  ring_size:        number of frame slots, 0 for num_workers + 2
+	*/
+	FusionEngine(const int num_workers = 0, const int ring_size = 0);
+	~FusionEngine();
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   scan a video
+	* @param  video_file_name:  name of multi-focus video
+	* @param  labels:           region id of every pixel (CV_32SC1)
+	* @param  num_regions:      number of regions
+	* @param  reduce:           consumer of the per-frame statistics
+	* @return:                  number of reduced frames; -1 failure
+	*/
+	int Run(const std::string& video_file_name, const cv::Mat& labels, const int num_regions,
+			const FrameReducer& reduce);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   choose the sharpness metric accumulated by the workers
+	* @param  measure:          one of FocusMeasureType
+	*/
+	void SetFocusMeasure(const int measure) { focus_measure = measure; }
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   evaluate the focus on a downsampled image, every level halves the
+	*                           resolution. The label map is sampled down accordingly, regions
+	*                           that vanish are still measured at full resolution
+	* @param  level:            pyramid level, 0 for full resolution
+	*/
+	void SetPyramidLevel(const int level) { pyramid_level = std::max(0, level); }
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   compute statistics for some frames only, the others are still
+	*                           decoded and passed to the reducer with empty statistics
+	* @param  selected:         non-zero for every frame to be evaluated, empty for all frames
+	*/
+	void SetFrameSelection(const std::vector<char>& selected) { selected_frames = selected; }
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   evaluate every region only on the frames of its window, outside of
+	*                           it the statistics of the region stay 0. Frames no region needs are
+	*                           passed to the reducer with empty statistics
+	* @param  first:            first frame of every region, empty for all frames
+	* @param  last:             last frame of every region (inclusive)
+	*/
+	void SetRegionFrameWindows(const std::vector<int>& first, const std::vector<int>& last)
+	{
+		window_first = first;
+		window_last = last;
+	}
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   stop evaluating a region for the rest of the current run, meant to
+	*                           be called by the reducer. Frames already in flight may still carry
+	*                           statistics of the region
+	* @param  region:           region id
+	*/
+	void RetireRegion(const int region);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   get the number of statistics workers
+	* @return:                  number of workers
+	*/
+	int num_workers() const { return workers; }
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   get the number of frame slots
+	* @return:                  number of slots
+	*/
+	int ring_size() const { return slots; }
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   get the allocations the decoder and the workers of the last run made
+	*                           for the frames after its warm-up, i.e. after every slot has carried
+	*                           one frame. Measured with an AllocationScope, expected to be 0. Only
+	*                           allocations reported through CountAllocation are seen
+	* @return:                  allocation count
+	*/
+	int64 steady_state_allocations() const { return steady_allocations; }
+
+private:
+	int workers;
+	int slots;
+	int64 steady_allocations;
+	int focus_measure;
+	int pyramid_level;
+	std::vector<char> selected_frames;
+	std::vector<int> window_first;
+	std::vector<int> window_last;
+
+	// regions retired during the current run
+	std::unique_ptr<std::atomic<char>[]> retired;
+	std::atomic<int> num_retired;
+	int num_run_regions;
+};
+
+#endif
@@ -1,11 +1,36 @@
 #ifndef GLOBAL_H_
 #define GLOBAL_H_
 
+#include <climits>
+
+#include "opencv2/core/core.hpp"
+
+// one entry for every possible 16-bit depth value
+#define DEPTH_COLOR_TABLE_SIZE		(USHRT_MAX + 1)
+
+/* ************************************************************************* */
+/**
+* @brief:                       get the look up table for visualizing depth map, the table is built
+*                               thread-safely on first use
+* @return:                      table with DEPTH_COLOR_TABLE_SIZE log-scaled intensities
+*/
+const unsigned char* GetDepthColorTable(void);
+
 /* ************************************************************************* */
 /**
-* @brief:                       initialize the look up table for visualizing depth map  
+* @brief:                       initialize the look up table for visualizing depth map, calling
+*                               this is optional since the table is built on first use
 * @return:                      0 success; 1 failure
 */
 int InitializeDepthColorTable(void);
 
-#endif
\ No newline at end of file
+/* ************************************************************************* */
+/**
+* @brief:                       map a depth map to log-scaled 8-bit intensities
+* @param  depth:                depth map (CV_16UC1)
+* @param  depth_show:           visualized depth map (CV_8UC1)
+* @return:                      0 success; 1 failure
+*/
+int ColorizeDepth(const cv::Mat& depth, cv::Mat& depth_show);
+
+#endif
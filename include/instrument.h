@@ -0,0 +1,116 @@
+/**
+* @file instrument.h
+* @brief Scoped stage timers and event counters with Chrome trace export
+*/
+
+#ifndef INSTRUMENT_H_
+#define INSTRUMENT_H_
+
+#include <ostream>
+#include <string>
+
+#include "opencv2/core/core.hpp"
+
+/*
+    Scoped stage timers and event counters. Building with -DENABLE_INSTRUMENTATION turns
+    the INSTRUMENT_* macros on, otherwise they expand to nothing and their arguments are
+    not evaluated, so instrumented code costs nothing in a normal build. Every thread
+    records into its own buffer; the buffers are exported as Chrome trace JSON (open it in
+    chrome://tracing or ui.perfetto.dev) or summed up into a table.
+*/
+
+// counters, every INSTRUMENT_COUNT adds to the total and records a sample of it in the trace
+enum InstrumentCounter
+{
+	COUNTER_EDGES = 0,				// edges of the segmentation graphs
+	COUNTER_JOINS = 1,				// union-find joins, depth of field and small component merges
+	COUNTER_REGIONS = 2,			// regions of the segmentations
+	COUNTER_FRAMES_DECODED = 3,		// video frames decoded by the fusion
+	COUNTER_FOCUS_EVALUATIONS = 4,	// region focus scores computed, one per region and frame
+	COUNTER_BYTES_ALLOCATED = 5,	// bytes of buffers allocated or grown by the stages
+	NUM_INSTRUMENT_COUNTERS = 6
+};
+
+/* ************************************************************************* */
+/**
+* @brief Records the time between its construction and its destruction as one event of
+*        the calling thread
+*/
+class ScopedInstrumentTimer{
+public:
+	/* ************************************************************************* */
+	/**
+	* @brief:                   start timing
+	* @param  name:             event name, must stay valid until the export (a string literal)
+	*/
+	explicit ScopedInstrumentTimer(const char* name);
+	~ScopedInstrumentTimer();
+
+private:
+	ScopedInstrumentTimer(const ScopedInstrumentTimer&);
+	ScopedInstrumentTimer& operator=(const ScopedInstrumentTimer&);
+
+	const char* name;
+	int64 start;
+};
+
+/* ************************************************************************* */
+/**
+* @brief:                       add to a counter
+* @param  counter:              one of InstrumentCounter
+* @param  value:                amount added
+*/
+void InstrumentCount(const int counter, const int64 value);
+
+/* ************************************************************************* */
+/**
+* @brief:                       get the total of a counter
+* @param  counter:              one of InstrumentCounter
+* @return:                      total since the last reset, 0 for an unknown counter
+*/
+int64 GetInstrumentCounter(const int counter);
+
+/* ************************************************************************* */
+/**
+* @brief:                       drop the recorded events and zero the counters, timestamps of the
+*                               trace start over
+*/
+void ResetInstrumentation(void);
+
+/* ************************************************************************* */
+/**
+* @brief:                       write the recorded events in the Chrome trace event format. Must
+*                               not run while instrumented stages are running
+* @param  file_name:            JSON file
+* @return:                      0 success; 1 failure
+*/
+int ExportChromeTrace(const std::string& file_name);
+
+/* ************************************************************************* */
+/**
+* @brief:                       print calls, total, mean and maximum time of every event name and the
+*                               counter totals. Must not run while instrumented stages are running
+* @param  out:                  output stream
+*/
+void PrintInstrumentSummary(std::ostream& out);
+
+/* ************************************************************************* */
+/**
+* @brief:                       check whether the macros were compiled in
+* @return:                      true if built with ENABLE_INSTRUMENTATION
+*/
+bool IsInstrumentationEnabled(void);
+
+#define INSTRUMENT_CONCAT_(a, b)	a##b
+#define INSTRUMENT_CONCAT(a, b)		INSTRUMENT_CONCAT_(a, b)
+
+#ifdef ENABLE_INSTRUMENTATION
+// time the rest of the enclosing scope
+#define INSTRUMENT_SCOPE(name)				ScopedInstrumentTimer INSTRUMENT_CONCAT(instrument_timer_, __LINE__)(name)
+#define INSTRUMENT_COUNT(counter, value)	InstrumentCount(counter, value)
+#else
+#define INSTRUMENT_SCOPE(name)				do {} while (0)
+#define INSTRUMENT_COUNT(counter, value)	do {} while (0)
+#endif
+
+#endif
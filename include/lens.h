@@ -0,0 +1,155 @@
+/**
+* @file lens.h
+* @brief Lens profile and depth of field tables of the camera that captured the focal stack
+*/
+
+#ifndef LENS_H_
+#define LENS_H_
+
+#include <climits>
+#include <vector>
+
+// one entry for every possible 16-bit depth value (mm)
+#define DOF_TABLE_SIZE		(USHRT_MAX + 1)
+
+typedef struct FrontBackDOF
+{
+	double front_dof;
+	double back_dof;
+	double total_dof;
+} FrontBackDOF;
+
+typedef struct LensProfile
+{
+	double coc_diameter;	// diameter of the circle of confusion (mm)
+	double aperture_value;	// f-number
+	double focal_length;	// mm
+} LensProfile;
+
+/* ************************************************************************* */
+/**
+* @brief:                       make a lens profile
+* @param  coc_diameter:         diameter of the circle of confusion (mm)
+* @param  aperture_value:       f-number
+* @param  focal_length:         focal length (mm)
+* @return:                      lens profile
+*/
+LensProfile MakeLensProfile(const double coc_diameter, const double aperture_value,
+							const double focal_length);
+
+/* ************************************************************************* */
+/**
+* @brief:                       calculate front and back depth of field of a lens focused at distance
+* @param  lens:                 lens profile
+* @param  distance:             focus distance (mm)
+* @return:                      front and back depth of field (mm)
+*/
+FrontBackDOF ComputeFrontBackDof(const LensProfile& lens, const double distance);
+
+/* ************************************************************************* */
+/**
+* @brief:                       round up to an int, saturating at the int range
+* @param  value:                value
+* @return:                      smallest int not below value, INT_MIN for NaN
+*/
+int CeilToInt(const double value);
+
+/* ************************************************************************* */
+/**
+* @brief Front and back depth of field of every integer distance in [0, DOF_TABLE_SIZE).
+*        Other distances fall back to ComputeFrontBackDof, so lookups always give the
+*        same value as the direct computation.
+*/
+class DofTable{
+public:
+	DofTable();
+	~DofTable();
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   fill the tables for a lens
+	* @param  lens:             lens profile
+	* @return:                  0 success; 1 invalid lens, the previous tables are kept
+	*/
+	int Build(const LensProfile& lens);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   check whether no valid lens has been built yet
+	* @return:                  true if the tables are empty
+	*/
+	bool empty() const { return front_dof.empty(); }
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   get the lens profile the tables were built for
+	* @return:                  lens profile
+	*/
+	const LensProfile& lens() const { return profile; }
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   get the front depth of field at distance
+	* @param  distance:         focus distance (mm)
+	* @return:                  front depth of field (mm)
+	*/
+	double front(const double distance) const
+	{
+		if (!front_dof.empty() && distance >= 0 && distance < DOF_TABLE_SIZE)
+		{
+			const int idx = static_cast<int>(distance);
+			if (idx == distance) return front_dof[idx];
+		}
+		return ComputeFrontBackDof(profile, distance).front_dof;
+	}
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   get the back depth of field at distance
+	* @param  distance:         focus distance (mm)
+	* @return:                  back depth of field (mm), negative beyond the hyperfocal distance
+	*/
+	double back(const double distance) const
+	{
+		if (!back_dof.empty() && distance >= 0 && distance < DOF_TABLE_SIZE)
+		{
+			const int idx = static_cast<int>(distance);
+			if (idx == distance) return back_dof[idx];
+		}
+		return ComputeFrontBackDof(profile, distance).back_dof;
+	}
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   get the front depth of field at an integer distance rounded up, an
+	*                           integer depth difference diff satisfies diff < front(distance)
+	*                           exactly when diff < front_ceil(distance)
+	* @param  distance:         focus distance (mm)
+	* @return:                  rounded up front depth of field (mm)
+	*/
+	int front_ceil(const unsigned short distance) const
+	{
+		return front_dof_ceil.empty() ? CeilToInt(front(distance)) : front_dof_ceil[distance];
+	}
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   get the back depth of field at an integer distance rounded up, see
+	*                           front_ceil
+	* @param  distance:         focus distance (mm)
+	* @return:                  rounded up back depth of field (mm)
+	*/
+	int back_ceil(const unsigned short distance) const
+	{
+		return back_dof_ceil.empty() ? CeilToInt(back(distance)) : back_dof_ceil[distance];
+	}
+
+private:
+	LensProfile profile;
+	std::vector<double> front_dof;
+	std::vector<double> back_dof;
+	std::vector<int> front_dof_ceil;
+	std::vector<int> back_dof_ceil;
+};
+
+#endif
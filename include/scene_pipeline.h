@@ -0,0 +1,87 @@
+/**
+* @file scene_pipeline.h
+* @brief Run scenes through align, fill, segment and fuse, one at a time or as a batch
+*/
+
+#ifndef SCENE_PIPELINE_H_
+#define SCENE_PIPELINE_H_
+
+#include <string>
+#include <vector>
+
+#include "lens.h"
+#include "select_combine.h"
+#include "work_stealing_pool.h"
+
+typedef struct SceneEntry
+{
+	std::string depth_file;		// depth file or FileStorage XML
+	std::string video_file;		// multi-focus video
+	LensProfile lens;
+	std::string output_prefix;	// prepended to the names of the output images
+} SceneEntry;
+
+typedef struct SceneSettings
+{
+	FusionOptions fusion;
+	int small_thresh;			// least pixels of a region
+	int tile_size;				// tile-parallel segmentation, 0 for serial
+	bool concurrent_merge;
+} SceneSettings;
+
+typedef struct SceneResult
+{
+	int status;					// 0 success; 1 failure
+	int num_regions;
+	double load_ms;
+	double align_ms;			// alignment including the hole filling
+	double segment_ms;
+	double fuse_ms;
+	double total_ms;
+} SceneResult;
+
+/* ************************************************************************* */
+/**
+* @brief:                       get the default scene settings
+* @return:                      settings
+*/
+SceneSettings GetDefaultSceneSettings(void);
+
+/* ************************************************************************* */
+/**
+* @brief:                       read a batch manifest, one scene per line:
+*                               depth video coc_diameter aperture_value focal_length [output_prefix]
+*                               Empty lines and lines starting with # are skipped, the output prefix
+*                               defaults to scene<line>_
+* @param  file_name:            manifest
+* @param  scenes:               scenes in manifest order
+* @return:                      0 success; 1 failure (missing file or malformed line)
+*/
+int LoadSceneManifest(const std::string& file_name, std::vector<SceneEntry>& scenes);
+
+/* ************************************************************************* */
+/**
+* @brief:                       process one scene and write <prefix>segmentation_result.jpg and
+*                               <prefix>all_in_focus.jpg
+* @param  scene:                scene
+* @param  settings:             processing settings
+* @param  result:               status and stage timings
+* @return:                      0 success; 1 failure
+*/
+int RunScene(const SceneEntry& scene, const SceneSettings& settings, SceneResult& result);
+
+/* ************************************************************************* */
+/**
+* @brief:                       process scenes concurrently on a pool. The stages of every scene
+*                               run their parallel loops, and the fusion its decoding and statistics
+*                               tasks, on the same pool, so no scene starts threads of its own
+* @param  scenes:               scenes
+* @param  settings:             processing settings
+* @param  pool:                 pool
+* @param  results:              status and stage timings of every scene
+* @return:                      number of failed scenes
+*/
+int RunSceneBatch(const std::vector<SceneEntry>& scenes, const SceneSettings& settings,
+				  WorkStealingPool& pool, std::vector<SceneResult>& results);
+
+#endif
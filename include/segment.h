@@ -18,33 +18,80 @@
 // #include <cstdlib>
 // #include <algorithm>
 // #include <cmath>
-#include "disjoint.h"
+#include "union_find.h"
+#include "concurrent_union_find.h"
+#include "edge_graph.h"
+#include "lens.h"
 
 #include "opencv2/core/core.hpp"
 
+#include <atomic>
 #include <limits.h>
+#include <memory>
+#include <mutex>
 
-typedef struct FrontBackDOF
+typedef struct RegionInfo
 {
-	double front_dof;
-	double back_dof;
-	double total_dof;
-} FrontBackDOF;
+	int pixel_count;
+	cv::Rect bounding_box;	// in label map coordinates
+} RegionInfo;
 
-typedef struct 
+// segmentation of the previous frame of a depth sequence, in sensor orientation (not mirrored)
+typedef struct TemporalSegmentation
 {
-	double w;
-	int a, b;
-} Edge;
+	cv::Mat reference_depth;		// depth every pixel was last segmented with (CV_16UC1)
+	std::vector<int> labels;		// region id of every pixel
+	std::vector<ushort> region_min;	// depth bounds of every region
+	std::vector<ushort> region_max;
+	std::vector<int> region_size;
+	std::vector<int> free_labels;	// ids of regions without pixels, reused first
+	int num_dirty_tiles;			// tiles segmented again for the last frame
+} TemporalSegmentation;
 
-/* ************************************************************************* */
-/**
-* @brief:			compare edges based on edge weight
-* @param  a:		edge a
-* @param  b:		edge b
-* @return:  		true: a.w < b.w	false: a.w > b.w
-*/
-bool Comparison(const Edge& a, const Edge& b);
+// edge of the re-segmented pixels of a frame, target is a dirty pixel or -1 - id of a clean region
+typedef struct TemporalEdge
+{
+	int weight;
+	int source;
+	int target;
+} TemporalEdge;
+
+// buffers of the segmentation. They grow to the largest frame seen and are reused by every
+// call, so segmenting frames of the same size does not allocate
+typedef struct SegmentationWorkspace
+{
+	EdgeGraph<ushort> integral_graph;		// integral depth
+	EdgeGraph<double> graph;				// other depth
+	UnionFind forest;
+	// depth bounds of every component, elements of the pixel type of the depth map
+	std::vector<double> component_min;
+	std::vector<double> component_max;
+	std::vector<int> label_of_root;
+
+	// tile-parallel segmentation
+	std::vector<int> edge_bucket;
+	std::vector<int> bucket_histograms;
+	std::vector<int> bucket_offsets;
+	std::vector<int> bucketed_edges;
+	std::vector<int> tile_merges;
+
+	// concurrent stitching, every component root is guarded by one of the lock stripes
+	ConcurrentUnionFind concurrent_forest;
+	std::unique_ptr<std::mutex[]> merge_locks;
+
+	// temporal segmentation
+	std::vector<char> changed_tiles;
+	std::vector<char> dirty_tiles;
+	std::vector<int> local_of_pixel;
+	std::vector<int> dirty_pixels;
+	std::vector<int> attached;
+	std::vector<TemporalEdge> temporal_edges;
+	std::vector<TemporalEdge> temporal_sorted;
+	std::vector<int> temporal_histogram;
+	std::vector<ushort> temporal_min;
+	std::vector<ushort> temporal_max;
+	UnionFind temporal_forest;
+} SegmentationWorkspace;
 
 class GraphBasedImageSeg{
 public:
@@ -54,48 +101,188 @@ public:
 	/* ************************************************************************* */
 	/**
 	* @brief:  					this function implements the graph based image segmentation method
-	* @param  depth_map:		original depth map to be segmented
+	* @param  depth_map:		original depth map to be segmented (CV_16UC1, CV_32FC1 or CV_64FC1)
 	* @param  small_thresh:		determine the least pixels of each specific region
 	* @param  regions:			array of segmented regions	
 	* @param  dst: 				colorized segmentation result  
-	* @return:					number of segmented regions
+	* @return:					number of segmented regions; -1 unsupported depth type or no valid lens
 	*/
 	int GraphSegment(const cv::Mat& depth_map, const int small_thresh, std::vector<cv::Mat>& regions,
 					 cv::Mat& dst);
-private:
+
 	/* ************************************************************************* */
 	/**
-	* @brief:		 	this function calculated difference of two pixel values 
-	* @param  depth:	original depth image
-	* @param  x1:	 	X coordinate of pixel 1
-	* @param  y1:      	Y coordinate of pixel 1
-	* @param  x2:     	X coordinate of pixel 2
-	* @param  y2:     	Y coordinate of pixel 2
-	* @return:		 	calculated difference value 	
-	*/ 
-	double Dissim(const cv::Mat& depth, const int x1, const int y1, 
-				  const int x2, const int y2);
+	* @brief:  					segment the depth map into a dense label map, computed in a single
+	*							pass over the pixels. 16-bit depth is segmented natively with integer
+	*							weights and depth of field bounds, the result equals the one of the
+	*							same depth given as CV_64FC1
+	* @param  depth_map:		original depth map to be segmented (CV_16UC1, CV_32FC1 or CV_64FC1)
+	* @param  small_thresh:		determine the least pixels of each specific region
+	* @param  labels:			region id (0..R-1) of every pixel (CV_32SC1), mirrored horizontally
+	*							like the masks of the other overload
+	* @param  region_info:		pixel count and bounding box of every region
+	* @param  dst: 				colorized segmentation result  
+	* @return:					number of segmented regions R; -1 unsupported depth type or no valid lens
+	*/
+	int GraphSegment(const cv::Mat& depth_map, const int small_thresh, cv::Mat& labels,
+					 std::vector<RegionInfo>& region_info, cv::Mat& dst);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:  					split the depth map into tiles that are segmented in parallel and
+	*							stitched by their border edges in weight order afterwards
+	* @param  tile_size:		side length of the tiles in pixels, 0 for the serial segmentation
+	* @param  concurrent_merge:	stitch the tiles from several threads. The border edges are still
+	*							taken in weight order, but edges of equal weight are merged in no
+	*							particular order, so the regions may differ from the serial stitch.
+	*							Every region still satisfies the depth of field criterion
+	*/
+	void SetTileParallel(const int tile_size, const bool concurrent_merge = false);
 
 	/* ************************************************************************* */
 	/**
-	* @brief: 			   this function calculates front and back depth of field based on the given
-	*		 			   depth value
-	* @param depth_value:  depth value
-	* @return			   calculated front and back depth of field in depth_value
+	* @brief:  					switch to another lens, only the depth of field tables are rebuilt
+	* @param  lens:				lens profile
+	* @return:					0 success; 1 invalid profile, the previous lens is kept
 	*/
-	FrontBackDOF GetFrontBackDof(const double depth_value);
+	int SetLensProfile(const LensProfile& lens);
 
+	/* ************************************************************************* */
+	/**
+	* @brief:  					get the current lens profile
+	* @return:					lens profile
+	*/
+	const LensProfile& GetLensProfile() const { return dof_table.lens(); }
+
+	/* ************************************************************************* */
+	/**
+	* @brief:  					configure the temporal mode of GraphSegmentNext
+	* @param  dirty_tile_size:	side length of the tiles compared with the previous frame
+	* @param  change_thresh:	a tile is segmented again once one of its pixels changed by more
+	*							than this (mm)
+	*/
+	void SetTemporal(const int dirty_tile_size, const int change_thresh);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:  					segment the next frame of a depth sequence. Only the tiles whose depth
+	*							changed and their neighbours are segmented again, their components
+	*							join the adjacent regions of the previous frame where the depth of
+	*							field allows it and get new ids otherwise. Region ids stay stable
+	*							over the sequence and ids of vanished regions are reused. The first
+	*							frame, a size change or changes in more than half of the tiles
+	*							segment the whole frame
+	* @param  depth_map:		next depth map (CV_16UC1)
+	* @param  small_thresh:		determine the least pixels of each specific region
+	* @param  labels:			region id of every pixel (CV_32SC1), mirrored like GraphSegment
+	* @param  region_info:		pixel count and bounding box of every region id, ids without pixels
+	*							have a pixel count of 0
+	* @param  dst: 				colorized segmentation result, every id keeps its color
+	* @return:					number of region ids R; -1 unsupported depth type or no valid lens
+	*/
+	int GraphSegmentNext(const cv::Mat& depth_map, const int small_thresh, cv::Mat& labels,
+						 std::vector<RegionInfo>& region_info, cv::Mat& dst);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:  					forget the previous frame, the next GraphSegmentNext starts over
+	*/
+	void ResetTemporal();
+
+	/* ************************************************************************* */
+	/**
+	* @brief:  					get the number of tiles the last GraphSegmentNext segmented again
+	* @return:					number of tiles, -1 if the whole frame was segmented
+	*/
+	int num_dirty_tiles() const { return temporal.num_dirty_tiles; }
+private:
 	/* ************************************************************************* */
 	/**
 	* @brief: 				graph based depth map segmentation method based on edge graphs
+	* @param  depth_map: 	original depth to be segmented, elements of type PixelT
+	* @param  num_vertices: number of vertices of edge graphs (equals depth_map.rows * depth_map.cols)
+	* @param  graph: 		edge graph, sorted by weight on return
+	* @return: 				segmented regions represented in linking disjoints, owned by the workspace
+	*/
+	template <typename PixelT, typename WeightT>
+	UnionFind *SegGraph(const cv::Mat& depth_map, const int num_vertices, 
+					   EdgeGraph<WeightT>& graph);
+
+	/* ************************************************************************* */
+	/**
+	* @brief: 				tile-parallel version of SegGraph
 	* @param  depth_map: 	original depth to be segmented
 	* @param  num_vertices: number of vertices of edge graphs (equals depth_map.rows * depth_map.cols)
-	* @param  num_edges: 	number of edges of edge graphs(about num_vertices * 4)
-	* @param  edges: 		edge graph	
-	* @return: 				segmented regions represented in linking disjoints
+	* @param  graph: 		edge graph, sorted by weight on return
+	* @return: 				segmented regions represented in linking disjoints, owned by the workspace
 	*/
-	DisJoint *SegGraph(const cv::Mat& depth_map, const int num_vertices, 
-					   const int num_edges, Edge* edges);
+	template <typename PixelT, typename WeightT>
+	UnionFind *SegGraphTiled(const cv::Mat& depth_map, const int num_vertices, 
+							 EdgeGraph<WeightT>& graph);
+
+	/* ************************************************************************* */
+	/**
+	* @brief: 					stitch tiles concurrently. Runs of border edges with equal weight are
+	*							split over the threads, one run after the other. The finds are
+	*							lock-free, a merge locks both roots so that it checks the criterion
+	*							against the current bounds of both components
+	* @param  d: 				segmented tiles, updated in place
+	* @param  depth_map: 		original depth, elements of type PixelT
+	* @param  graph: 			edge graph sorted by weight
+	* @param  boundary_edges: 	indices of the edges crossing tile borders in weight order
+	* @param  num_boundary_edges: number of border edges
+	* @param  component_min:	minimum depth of each component, updated for the merged roots
+	* @param  component_max:	maximum depth of each component, updated for the merged roots
+	*/
+	template <typename PixelT, typename WeightT>
+	void MergeBoundariesConcurrent(UnionFind* d, const cv::Mat& depth_map, const EdgeGraph<WeightT>& graph,
+								   const int* boundary_edges, const int num_boundary_edges,
+								   PixelT* component_min, PixelT* component_max);
+
+	/* ************************************************************************* */
+	/**
+	* @brief: 				depth of field merge criterion of two components
+	* @param  minimum: 		minimum depth of the merged component
+	* @param  maximum: 		maximum depth of the merged component
+	* @return: 				true if the merged depth range is within the depth of field
+	*/
+	bool WithinDof(const double minimum, const double maximum);
+
+	/* ************************************************************************* */
+	/**
+	* @brief: 				integer version of the depth of field merge criterion, same result as
+	*						the double version for the same depths
+	* @param  minimum: 		minimum depth of the merged component
+	* @param  maximum: 		maximum depth of the merged component
+	* @return: 				true if the merged depth range is within the depth of field
+	*/
+	bool WithinDof(const ushort minimum, const ushort maximum);
+
+	/* ************************************************************************* */
+	/**
+	* @brief: 					merge two components if the criterion allows it, the set count
+	*							of d is left to the caller
+	* @param  d: 				disjoint sets
+	* @param  a: 				root of one component
+	* @param  b: 				root of the other component
+	* @param  component_min:	minimum depth of each component
+	* @param  component_max:	maximum depth of each component
+	* @return: 					true if merged
+	*/
+	template <typename PixelT>
+	bool MergeWithinDof(UnionFind* d, int a, int b, PixelT* component_min, PixelT* component_max);
+
+	/* ************************************************************************* */
+	/**
+	* @brief: 				build the edge graph, segment it and merge small components
+	* @param  depth_map: 	original depth to be segmented, elements of type PixelT
+	* @param  small_thresh:	determine the least pixels of each specific region
+	* @param  graph: 		edge graph to be filled
+	* @return: 				segmented regions represented in linking disjoints, owned by the workspace
+	*/
+	template <typename PixelT, typename WeightT>
+	UnionFind *SegmentEdges(const cv::Mat& depth_map, const int small_thresh,
+						   EdgeGraph<WeightT>& graph);
 
 	/* ************************************************************************* */
 	/**
@@ -116,13 +303,75 @@ private:
 	*/
 	//unsigned char GetIntensity(const int depth_value);
 
+	/* ************************************************************************* */
+	/**
+	* @brief: 				segment a depth map of element type PixelT, integral depth gets 16-bit
+	*						edge weights
+	* @param  depth_map: 	original depth to be segmented
+	* @param  small_thresh:	determine the least pixels of each specific region
+	* @return: 				segmented regions represented in linking disjoints, owned by the workspace
+	*/
+	template <typename PixelT>
+	UnionFind *SegmentDepth(const cv::Mat& depth_map, const int small_thresh);
+
+	/* ************************************************************************* */
+	/**
+	* @brief: 				segment a whole frame into the temporal state
+	* @param  depth_map: 	depth map (CV_16UC1)
+	* @param  small_thresh:	determine the least pixels of each specific region
+	*/
+	void SegmentTemporalFull(const cv::Mat& depth_map, const int small_thresh);
+
+	/* ************************************************************************* */
+	/**
+	* @brief: 				segment the dirty tiles again and stitch them into the temporal state
+	* @param  depth_map: 	depth map (CV_16UC1)
+	* @param  small_thresh:	determine the least pixels of each specific region
+	* @param  dirty_tiles:	non-zero for every tile to be segmented again, row-major
+	* @param  tiles_x: 		number of tile columns
+	*/
+	void SegmentTemporalTiles(const cv::Mat& depth_map, const int small_thresh,
+							  const std::vector<char>& dirty_tiles, const int tiles_x);
+
 private:
-	// diameter of the circle of confusion
-	double fai; 
-	double F;
-	double f;	
+	GraphBasedImageSeg(const GraphBasedImageSeg&);
+	GraphBasedImageSeg& operator=(const GraphBasedImageSeg&);
+
+	// depth of field of the current lens at every integer depth
+	DofTable dof_table;
+
+	// tile side length of the parallel segmentation, 0 for serial
+	int tile_size;
+	bool concurrent_merge;
+
+	// temporal mode
+	int dirty_tile_size;
+	int change_thresh;
+	TemporalSegmentation temporal;
+
+	SegmentationWorkspace workspace;
 };
 
+/* ************************************************************************* */
+/**
+* @brief:  					expand a label map into one mask per region
+* @param  labels:			region id of every pixel (CV_32SC1)
+* @param  num_regions:		number of regions
+* @param  regions:			masks (CV_8UC1, 255 inside the region)
+* @return:					0 success; 1 failure
+*/
+int LabelsToRegions(const cv::Mat& labels, const int num_regions, std::vector<cv::Mat>& regions);
+
+/* ************************************************************************* */
+/**
+* @brief:  					get the mask of a single region
+* @param  labels:			region id of every pixel (CV_32SC1)
+* @param  label:			region id
+* @param  mask:				mask (CV_8UC1, 255 inside the region)
+* @return:					0 success; 1 failure
+*/
+int GetRegionMask(const cv::Mat& labels, const int label, cv::Mat& mask);
+
 
 
 
@@ -3,6 +3,8 @@
 
 #include <vector>
 #include "opencv2/core/core.hpp"
+
+#include "focus_measure.h"
 /*
     dir2/foo2.h.
     C system files.
@@ -27,6 +29,97 @@ int ConstructAllInFocusImage(const std::vector<cv::Mat>& segmented_regions,
                              const std::string video_file_name, 
                              cv::Mat& all_in_focus_img);
 
+// how the all-in-focus image is put together once the best frame of every region is known
+enum FusionComposeMode
+{
+    FUSION_COMPOSE_CACHE = 0,       // keep the current winner frames, decode again if they do not fit
+    FUSION_COMPOSE_REDECODE = 1     // decode the video a second time and copy the winning pixels
+};
+
+typedef struct FusionOptions
+{
+    int compose_mode;
+    // maximum number of winner frames kept in memory by FUSION_COMPOSE_CACHE
+    int cache_frames;
+    // threads computing focus statistics while the next frames are decoded, 0 for automatic
+    int num_workers;
+    // sharpness metric, one of FocusMeasureType
+    int focus_measure;
+    // coarse to fine search: every frame is scored on this pyramid level first (0 disables it)
+    // and only the top_k sharpest frames of each region are scored again at full resolution
+    int coarse_level;
+    int top_k;
+    // a region is retired once its score stayed below (1 - retire_hysteresis) * peak for
+    // retire_frames evaluated frames in a row, the scan ends when every region is retired.
+    // 0 disables retirement
+    float retire_hysteresis;
+    int retire_frames;
+    // depth guided search: every region is only evaluated on the frames [first, last] whose
+    // depth of field can reach it (see ComputeFrameWindows), empty to search every frame
+    std::vector<int> frame_window_first;
+    std::vector<int> frame_window_last;
+} FusionOptions;
+
+/* ************************************************************************* */
+/**
+* @brief:                       get the default fusion options
+* @return:                      options
+*/
+FusionOptions GetDefaultFusionOptions(void);
+
+/* ************************************************************************* */
+/**
+* @brief:                       construct an all-in-focus image based on a label map, every frame
+*                               is scanned once no matter how many regions there are
+* @param  labels:               region id of every pixel (CV_32SC1), negative ids are ignored
+* @param  num_regions:          number of regions
+* @param  video_file_name:		name of multi-focus video
+* @param  all_in_focus_img:		constructed all in focus image
+* @return:                      0, success; -1 failure
+*/
+int ConstructAllInFocusImage(const cv::Mat& labels, const int num_regions,
+                             const std::string video_file_name, 
+                             cv::Mat& all_in_focus_img);
+
+/* ************************************************************************* */
+/**
+* @brief:                       construct an all-in-focus image based on a label map. Only the index
+*                               of the best frame of every region is kept while scanning, so the
+*                               memory does not grow with the number of regions
+* @param  labels:               region id of every pixel (CV_32SC1), negative ids are ignored
+* @param  num_regions:          number of regions
+* @param  video_file_name:		name of multi-focus video
+* @param  options:              how the image is composed
+* @param  all_in_focus_img:		constructed all in focus image
+* @param  best_frames:          index of the sharpest frame of every region, -1 if none
+* @return:                      0, success; -1 failure
+*/
+int ConstructAllInFocusImage(const cv::Mat& labels, const int num_regions,
+                             const std::string video_file_name, const FusionOptions& options,
+                             cv::Mat& all_in_focus_img, std::vector<int>& best_frames);
+
+/* ************************************************************************* */
+/**
+* @brief:                       accumulate pixel count, sum and sum of squares of every region
+*                               in a single pass over the image
+* @param  gray_img:             image (CV_8UC1)
+* @param  labels:               region id of every pixel (CV_32SC1), ids outside [0, num_regions)
+*                               are ignored
+* @param  num_regions:          number of regions
+* @param  stats:                statistics of every region, resized and overwritten
+* @return:                      0, success; -1 failure
+*/
+int AccumulateRegionStatistics(const cv::Mat& gray_img, const cv::Mat& labels, const int num_regions,
+                               std::vector<RegionStatistics>& stats);
+
+/* ************************************************************************* */
+/**
+* @brief:                       normalized variance (variance / mean) of a region
+* @param  stats:                statistics of the region
+* @return:                      normalized variance value, 0 for empty or black regions
+*/
+float NormalizedVariance(const RegionStatistics& stats);
+
 
 /* ************************************************************************* */
 /**
@@ -0,0 +1,105 @@
+/**
+* @file union_find.h
+* @brief Disjoint set forest with a single dense int per element
+*/
+
+#ifndef UNION_FIND_H_
+#define UNION_FIND_H_
+
+#include <vector>
+
+/* ************************************************************************* */
+/**
+* @brief Drop-in replacement of DisJoint. Every element owns one int: a parent index
+*        (>= 0) for inner nodes and minus the set size (< 0) for roots, so the parent
+*        array stays dense and no rank is kept. Sets are joined by size and find
+*        splits the path it walks: every node on it is pointed at its grandparent.
+*/
+class UnionFind{
+public:
+	UnionFind(int elements = 0);
+	~UnionFind();
+
+	/* ************************************************************************* */
+	/**
+	* @brief	Start over with singleton sets, the storage of a larger forest is kept
+	* @param elements	Number of elements
+	*/
+	void Reset(int elements);
+
+	/* ************************************************************************* */
+	/**
+	* @brief	This Locates which region of the pixel in x belong to
+	* @param x	Location of the given pixel
+	* @return	The region id of pixel in location x
+	*/
+	int find(int x)
+	{
+		int* p = &parent[0];
+		while (p[x] >= 0) {
+			const int next = p[x];
+			if (p[next] >= 0) {
+				// point x to its grandparent
+				p[x] = p[next];
+			}
+			x = next;
+		}
+		return x;
+	}
+
+	/* ************************************************************************* */
+	/**
+	* @brief	Merge two regions
+	* @param x	One region id
+	* @param y  Another region id 
+	*/
+	void join(int x, int y)
+	{
+		link(x, y);
+		num--;
+	}
+
+	/* ************************************************************************* */
+	/**
+	* @brief	Merge two regions without updating the number of regions. Concurrent
+	*			calls are safe as long as they touch disjoint sets
+	* @param x	One region id
+	* @param y  Another region id 
+	*/
+	void link(int x, int y)
+	{
+		// the smaller set goes below the larger one, sizes are stored negated
+		if (parent[x] < parent[y]) {
+			parent[x] += parent[y];
+			parent[y] = x;
+		}
+		else {
+			parent[y] += parent[x];
+			parent[x] = y;
+		}
+	}
+
+	/* ************************************************************************* */
+	/**
+	* @brief	 Get the size of specific region
+	* @param  x	 Region id
+	* @return    Region size
+	*/
+	int size(int x) const { return -parent[x]; }
+
+	/* ************************************************************************* */
+	/**
+	* @brief	   Get the total regions of image
+	* @return	   Number of regions
+	*/
+	int num_sets() const { return num; }
+
+public:
+	// parent index, or minus the set size for roots
+	std::vector<int> parent;
+
+	// Number of regions of an image
+	int num;
+};
+
+#endif
@@ -0,0 +1,148 @@
+/**
+* @file work_stealing_pool.h
+* @brief Thread pool with per-worker task deques shared by scene-level and intra-stage parallelism
+*/
+
+#ifndef WORK_STEALING_POOL_H_
+#define WORK_STEALING_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+/*
+    Every worker owns a deque: it pushes and pops its own tasks at the back and idle
+    workers steal from the front of the others. Tasks submitted from outside go to a
+    shared injection queue. A ParallelFor issued from inside a task splits its range
+    into stripes on the deque of its worker and runs stripes itself until all of them
+    are done, so nested loops use the idle workers instead of starting more threads.
+*/
+
+class WorkStealingPool{
+public:
+	typedef std::function<void()> Task;
+	typedef std::function<void(const cv::Range&)> LoopBody;
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   start the workers
+	* @param  num_threads:      number of workers, 0 for one per hardware thread
+	*/
+	explicit WorkStealingPool(const int num_threads = 0);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   finish the submitted tasks and stop the workers
+	*/
+	~WorkStealingPool();
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   queue a task
+	* @param  task:             task
+	*/
+	void Submit(const Task& task);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   block until every submitted task has finished, must not be called
+	*                           from a task
+	*/
+	void Wait();
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   queue a task on the deque of the calling worker, from outside the
+	*                           pool on the injection queue. Wait does not wait for it, the caller
+	*                           tracks its completion
+	* @param  task:             task
+	*/
+	void Spawn(const Task& task);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   run one queued task on the calling thread, for callers that wait for
+	*                           spawned tasks. A worker leaves the injected scenes alone, like
+	*                           ParallelFor does
+	* @return:                  true if a task was run
+	*/
+	bool RunPendingTask();
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   run body over a range split into stripes, the calling thread takes
+	*                           part and returns once every stripe is done
+	* @param  range:            range
+	* @param  body:             called for disjoint sub-ranges covering range
+	* @param  nstripes:         number of stripes, <= 0 for four per worker
+	*/
+	void ParallelFor(const cv::Range& range, const LoopBody& body, const double nstripes = -1.);
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   get the number of workers
+	* @return:                  number of workers
+	*/
+	int num_threads() const { return static_cast<int>(queues.size()); }
+
+	/* ************************************************************************* */
+	/**
+	* @brief:                   get the pool the calling thread works for
+	* @return:                  pool, null if the caller is not a worker
+	*/
+	static WorkStealingPool* current();
+
+private:
+	WorkStealingPool(const WorkStealingPool&);
+	WorkStealingPool& operator=(const WorkStealingPool&);
+
+	typedef struct TaskQueue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	} TaskQueue;
+
+	void Push(TaskQueue& queue, const Task& task, const bool back);
+	bool Pop(TaskQueue& queue, Task& task, const bool back);
+	bool FindTask(const int self, const bool include_injected, Task& task);
+	void WorkerLoop(const int self);
+
+	std::vector<std::unique_ptr<TaskQueue> > queues;
+	TaskQueue injected;
+	std::vector<std::thread> threads;
+
+	// tasks sitting in any queue, and submitted tasks not finished yet
+	std::atomic<int> queued;
+	std::atomic<int> unfinished;
+
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+	std::condition_variable finished;
+	bool stopping;
+};
+
+/* ************************************************************************* */
+/**
+* @brief:                       parallel loop of the processing stages. Inside a WorkStealingPool
+*                               task it runs on that pool, elsewhere on cv::parallel_for_
+* @param  range:                range
+* @param  body:                 called for disjoint sub-ranges covering range
+* @param  nstripes:             number of stripes, <= 0 for the default split
+*/
+void ParallelFor(const cv::Range& range, const WorkStealingPool::LoopBody& body, const double nstripes = -1.);
+
+/* ************************************************************************* */
+/**
+* @brief:                       get the number of threads ParallelFor spreads over
+* @return:                      workers of the current pool, else cv::getNumThreads()
+*/
+int GetParallelThreads(void);
+
+#endif
@@ -1,139 +1,228 @@
 #include "align_fill.h"
  
+#include <algorithm>
 #include <climits>
+#include <cmath>
 #include <iostream>
+#include <vector>
 
 #include "opencv2/core/core.hpp"
+#include "opencv2/core/utility.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
-#include "opencv2/highgui/highgui.hpp" 
 
- extern unsigned char depth_color_table[USHRT_MAX + 1];
+#include "depth_reproject.h"
+#include "diagnostics.h"
+#include "global.h"
+#include "instrument.h"
+#include "work_stealing_pool.h"
 
 int AlignDepthWithColor(const cv::Mat& src_depth, cv::Mat& aligned_depth)
 {
-    // initialize the intrinsic and extrinsic parameters of the depth sensor 
-    // of Kinect and Pentax color camera
-	// Pentax
-    static double pentax_fx = 810.1948;	static double pentax_fy = 814.2451;
-	static double pentax_u0 = 329.0910;	static double pentax_v0 = 244.0002;
-	// Kinect
-	static double kinect_fx = 583.9147;	static double kinect_fy = 586.7294;
-	static double kinect_u0 = 328.9980;	static double kinect_v0 = 251.6837;
-	// extrinsic parameters 
-	static cv::Mat rotation_matrix = (cv::Mat_<double>(3, 3) << 0.9997,		0.0200,		0.0158,
-												        -0.0200,	0.9998,		0.0035,
-														-0.0157,	-0.0038,	0.9999);
-	static cv::Mat translation_matrix = (cv::Mat_<double>(3, 1) << 10, 53.8973, 40.4947); // 1.6944, 53.8973, 40.4947 
-                                                                                             // 10, 53.8973, 40.4947
-	int depth_map_height = src_depth.rows;
-	int depth_map_width = src_depth.cols;
-
-	cv::Mat tmp_depth_for_color = cv::Mat::zeros(depth_map_height, depth_map_width, CV_16UC1);
-
-	for (int row_idx = 0; row_idx < depth_map_height; ++row_idx)
-	{
-		const ushort* ptr_raw_depth_img = src_depth.ptr<ushort>(row_idx);
+	// the reprojection engine keeps its coefficient tables and scratch buffers between
+	// calls, one instance per thread so that scenes can be aligned concurrently
+	static thread_local DepthReprojector reprojector(GetDefaultRigCalibration());
+	INSTRUMENT_SCOPE("align");
 
-		for (int col_idx = 0; col_idx < depth_map_width; ++col_idx)
+	cv::Mat tmp_depth_for_color;
+	{
+		INSTRUMENT_SCOPE("reproject");
+		if (0 != reprojector.Reproject(src_depth, tmp_depth_for_color, REPROJECT_LAST_WRITE))
 		{
-			double raw_depth_value = static_cast<double>(ptr_raw_depth_img[col_idx]);
-			const double z_kinect = raw_depth_value;
-			const double x_kinect = (col_idx - kinect_u0) * z_kinect / kinect_fx;
-			const double y_kinect = (row_idx - kinect_v0) * z_kinect / kinect_fy;
+			return 1;
+		}
+	}
 
-			cv::Mat xyz_kinect = (cv::Mat_<double>(3, 1) << x_kinect, y_kinect, z_kinect);
+	cv::Mat tmp_dilated_depth;
+	{
+		INSTRUMENT_SCOPE("dilate");
+		cv::Mat element = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
+		cv::dilate(tmp_depth_for_color, tmp_dilated_depth, element);
+	}
+	
+	FillDepthHoles(tmp_dilated_depth, aligned_depth);
 
-			cv::Mat xyz_pentax = rotation_matrix * xyz_kinect + translation_matrix;
+	// Get the depth map to be shown, only when somebody is going to look at it
+	if (DiagEnabled(DIAG_DEBUG))
+	{
+		cv::Mat depth_for_color_show, filled_depth_show;
+		ColorizeDepth(tmp_depth_for_color, depth_for_color_show);
+		ColorizeDepth(aligned_depth, filled_depth_show);
 
-			const double z_pentax = xyz_pentax.at<double>(2, 0);
-			const double x_pentax = xyz_pentax.at<double>(0, 0);
-			const double y_pentax = xyz_pentax.at<double>(1, 0);
+		DiagWriteImage(DIAG_DEBUG, "mapped.jpg", depth_for_color_show);
+		DiagWriteImage(DIAG_DEBUG, "filled.jpg", filled_depth_show);
+	}
 
-			double tmp_pentax_col_idx = (x_pentax / z_pentax) * pentax_fx + pentax_u0;
-			double tmp_pentax_row_idx = (y_pentax / z_pentax) * pentax_fy + pentax_v0;
+	return 0;
+}
 
-			int pentax_col_idx = static_cast<int>(tmp_pentax_col_idx + 0.5);
-			int pentax_row_idx = static_cast<int>(tmp_pentax_row_idx + 0.5);
-			if (pentax_col_idx < 0)	pentax_col_idx = 0;
-			if (pentax_col_idx >= depth_map_width) pentax_col_idx = (depth_map_width - 1);
 
-			if (pentax_row_idx < 0)	pentax_row_idx = 0;
-			if (pentax_row_idx >= depth_map_height) pentax_row_idx = (depth_map_height - 1);
+/* ************************************************************************* */
+/**
+* @brief Conduction look up table of the anisotropic diffusion. flux[d + radius] holds
+*        exp(-d^2 / k^2) * d for every integer depth difference d with a non-zero
+*        conduction, larger differences do not contribute to the update
+*/
+typedef struct ConductionLut
+{
+	int radius;
+	std::vector<double> flux;
+} ConductionLut;
+
+static const double kFillLambda = 0.25;
+static const double kFillK = 25.0;
+static const int kFillColOffset = 1;
+static const int kFillRowOffset = 3;
+
+// tile size of the wavefront, a tile is processed row-major by one thread
+static const int kFillTileWidth = 64;
+static const int kFillTileHeight = 32;
+
+/* ************************************************************************* */
+/**
+* @brief:                       build the conduction look up table for the fixed diffusion constant
+* @return:                      look up table
+*/
+static ConductionLut BuildConductionLut(void)
+{
+	ConductionLut lut;
+	lut.radius = 0;
+	while (lut.radius < USHRT_MAX)
+	{
+		const double diff = static_cast<double>(lut.radius + 1);
+		if (0.0 == exp(-(diff * diff) / (kFillK * kFillK))) break;
+		++lut.radius;
+	}
 
-			// obtain depth value for color
-			ushort* ptr_tmp_depth_for_color = tmp_depth_for_color.ptr<ushort>(pentax_row_idx);
-			ptr_tmp_depth_for_color[pentax_col_idx] = z_pentax;
-		}
+	lut.flux.resize(2 * lut.radius + 1);
+	for (int d = -lut.radius; d <= lut.radius; ++d)
+	{
+		const double diff = static_cast<double>(d);
+		lut.flux[d + lut.radius] = exp(-(diff * diff) / (kFillK * kFillK)) * diff;
 	}
 
-	cv::Mat tmp_dilated_depth;
-	cv::Mat element = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
-	cv::dilate(tmp_depth_for_color, tmp_dilated_depth, element);
-	
-	FillDepthHoles(tmp_dilated_depth, aligned_depth);
+	return lut;
+}
 
-	// Get the depth map to be shown
-	cv::Mat depth_for_color_show = cv::Mat::zeros(depth_map_height, depth_map_width, CV_8UC1);
-	cv::Mat filled_depth_show = cv::Mat::zeros(depth_map_height, depth_map_width, CV_8UC1);
+/* ************************************************************************* */
+/**
+* @brief:                       conduction weighted depth difference
+* @param  lut:                  conduction look up table
+* @param  diff:                 depth difference
+* @return:                      exp(-diff^2 / k^2) * diff
+*/
+static inline double Flux(const ConductionLut& lut, const int diff)
+{
+	if (diff < -lut.radius || diff > lut.radius) return 0.0;
+	return lut.flux[diff + lut.radius];
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       run one diffusion pass over a single tile
+* @param  lut:                  conduction look up table
+* @param  src_depth:            depth map before this pass
+* @param  filled_depth:         depth map being filled, already holds a copy of src_depth
+* @param  tile:                 tile to be processed
+*/
+static void FillDepthHolesTile(const ConductionLut& lut, const cv::Mat& src_depth,
+							   cv::Mat& filled_depth, const cv::Rect& tile)
+{
+	const int last_col = src_depth.cols - 1;
+	const int col_begin = std::max(tile.x, kFillColOffset);
+	const int col_end = tile.x + tile.width;
+	const int row_begin = std::max(tile.y, kFillRowOffset);
+	const int row_end = tile.y + tile.height;
 
-	for (int row_idx = 0; row_idx < depth_map_height; ++row_idx)
+	for (int row = row_begin; row < row_end; ++row)
 	{
-		uchar* ptr_depth_for_color_show = depth_for_color_show.ptr<uchar>(row_idx);
-		ushort* ptr_depth_for_color = tmp_depth_for_color.ptr<ushort>(row_idx);
+		const ushort* ptr_src_depth = src_depth.ptr<ushort>(row);
+		// pixels to the east of the up up pixel have not been filled yet in the
+		// reference column-by-column order, so they are read from the source
+		const ushort* ptr_src_up_two = src_depth.ptr<ushort>(row - 2);
+		ushort* ptr_filled_depth = filled_depth.ptr<ushort>(row);
+		const ushort* ptr_temp_up_three = filled_depth.ptr<ushort>(row - 3);
+		const ushort* ptr_temp_up_two = filled_depth.ptr<ushort>(row - 2);
+		const ushort* ptr_temp_up_one = filled_depth.ptr<ushort>(row - 1);
+
+		for (int col = col_begin; col < col_end; ++col)
+		{
+			if (ptr_src_depth[col] >= 10) continue;
 
-		uchar* ptr_filled_depth_show = filled_depth_show.ptr<uchar>(row_idx);
-		ushort* ptr_filled_depth = aligned_depth.ptr<ushort>(row_idx);
+			// centered around the up up pixel
+			const int center = ptr_temp_up_two[col];
+			const int east = (col < last_col) ? ptr_src_up_two[col + 1] : center;
 
-		for (int col_idx = 0; col_idx < depth_map_width; ++col_idx)
-		{
-			ushort depth_for_color_val = ptr_depth_for_color[col_idx];
-			ptr_depth_for_color_show[col_idx] = depth_color_table[depth_for_color_val] & 0x000000ff;
+			const double flux = Flux(lut, ptr_temp_up_three[col] - center) +
+								Flux(lut, ptr_temp_up_one[col] - center) +
+								Flux(lut, east - center) +
+								Flux(lut, ptr_temp_up_two[col - 1] - center);
 
-			ushort filled_depth_val = ptr_filled_depth[col_idx];
-			ptr_filled_depth_show[col_idx] = depth_color_table[filled_depth_val] & 0x000000ff;
+			ptr_filled_depth[col] = static_cast<ushort>( center + kFillLambda * flux + 0.5 );
 		}
 	}
-
-	cv::imwrite("mapped.jpg", depth_for_color_show);
-	cv::imwrite("filled.jpg", filled_depth_show);
-
-	return 0;
 }
 
-
-int FillDepthHoles(const cv::Mat& src_depth, cv::Mat& filled_depth)
+/* ************************************************************************* */
+/**
+* @brief:                       run one diffusion pass over the whole depth map
+* @param  lut:                  conduction look up table
+* @param  src_depth:            depth map before this pass
+* @param  filled_depth:         depth map after this pass, must not share data with src_depth
+*/
+static void FillDepthHolesPass(const ConductionLut& lut, const cv::Mat& src_depth, cv::Mat& filled_depth)
 {
 	src_depth.copyTo(filled_depth);
-	double lambda = 0.25;
-	double k = 25.0;
 
-	int col_offset = 1;
-	int row_offset = 3;
+	// a pixel depends on the pixels above it and on the up up pixel of the column
+	// to its left, so tile (band, strip) only waits for (band - 1, strip) and
+	// (band, strip - 1): the tiles on one anti-diagonal are independent
+	const int num_strips = (src_depth.cols + kFillTileWidth - 1) / kFillTileWidth;
+	const int num_bands = (src_depth.rows + kFillTileHeight - 1) / kFillTileHeight;
 
-	for (int col = col_offset; col < src_depth.cols; ++col) 
+	for (int diagonal = 0; diagonal < num_strips + num_bands - 1; ++diagonal)
 	{
-		for (int row = row_offset; row < src_depth.rows; ++row) {
-			// centered around the up up pixel		
-			ushort* ptr_filled_depth = filled_depth.ptr<ushort>(row);
-			ushort* ptr_temp_up_three = filled_depth.ptr<ushort>(row - 3);
-			ushort* ptr_temp_up_two = filled_depth.ptr<ushort>(row - 2);
-			ushort* ptr_temp_up_one = filled_depth.ptr<ushort>(row - 1);
-
-			if (ptr_filled_depth[col] < 10) {
-				double ni = static_cast<double>(ptr_temp_up_three[col] - ptr_temp_up_two[col]);
-				double si = static_cast<double>(ptr_temp_up_one[col] - ptr_temp_up_two[col]);
-				double wi = static_cast<double>(ptr_temp_up_two[col - 1] - ptr_temp_up_two[col]);
-				double ei = static_cast<double>(ptr_temp_up_two[col + 1] - ptr_temp_up_two[col]);
-
-				double cn = exp(-(ni * ni) / (k * k));
-				double cs = exp(-(si * si) / (k * k));
-				double ce = exp(-(ei * ei) / (k * k));
-				double cw = exp(-(wi * wi) / (k * k));
-
-				ptr_filled_depth[col] = static_cast<ushort>( ptr_temp_up_two[col] + lambda * (cn * ni + cs * si + ce * ei + cw * wi) + 0.5 );
+		const int first_strip = std::max(0, diagonal - num_bands + 1);
+		const int last_strip = std::min(diagonal, num_strips - 1);
+
+		ParallelFor(cv::Range(first_strip, last_strip + 1), [&](const cv::Range& range)
+		{
+			for (int strip = range.start; strip < range.end; ++strip)
+			{
+				const int band = diagonal - strip;
+				const int x = strip * kFillTileWidth;
+				const int y = band * kFillTileHeight;
+				const cv::Rect tile(x, y, std::min(kFillTileWidth, src_depth.cols - x),
+									std::min(kFillTileHeight, src_depth.rows - y));
+				FillDepthHolesTile(lut, src_depth, filled_depth, tile);
 			}
+		});
+	}
+}
+
+/* ************************************************************************* */
+int FillDepthHoles(const cv::Mat& src_depth, cv::Mat& filled_depth, const int iterations)
+{
+	if (src_depth.empty() || CV_16UC1 != src_depth.type() || iterations < 1)
+	{
+		return 1;
+	}
+
+	static const ConductionLut lut = BuildConductionLut();
+	INSTRUMENT_SCOPE("fill_holes");
+
+	// every pass needs an untouched copy of its input
+	cv::Mat pass_src = (src_depth.data == filled_depth.data) ? src_depth.clone() : src_depth;
+	cv::Mat pass_dst;
+
+	for (int iter = 0; iter < iterations; ++iter)
+	{
+		FillDepthHolesPass(lut, pass_src, (iter + 1 == iterations) ? filled_depth : pass_dst);
+		if (iter + 1 < iterations)
+		{
+			if (0 == iter) pass_src = cv::Mat();
+			std::swap(pass_src, pass_dst);
 		}
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,84 @@
+/**
+* @file concurrent_union_find.cpp
+* @brief Lock-free disjoint set forest for merging segments from several threads
+*/
+
+#include "concurrent_union_find.h"
+
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/core/utility.hpp"
+
+#include "work_stealing_pool.h"
+
+/* ************************************************************************* */
+ConcurrentUnionFind::ConcurrentUnionFind(int elements) : num(0), capacity(0)
+{
+	Reset(elements);
+}
+
+/* ************************************************************************* */
+ConcurrentUnionFind::~ConcurrentUnionFind()
+{
+}
+
+/* ************************************************************************* */
+void ConcurrentUnionFind::Reset(int elements)
+{
+	if (elements > capacity)
+	{
+		parent.reset(new std::atomic<int>[elements]);
+		capacity = elements;
+	}
+	num = elements;
+
+	for (int i = 0; i < elements; i++) {
+		parent[i].store(i, std::memory_order_relaxed);
+	}
+}
+
+/* ************************************************************************* */
+void ConcurrentUnionFind::Assign(const UnionFind& sets)
+{
+	CV_Assert(static_cast<int>(sets.parent.size()) == num);
+
+	ParallelFor(cv::Range(0, num), [&](const cv::Range& range)
+	{
+		for (int i = range.start; i < range.end; i++) {
+			const int p = sets.parent[i];
+			parent[i].store((p < 0) ? i : p, std::memory_order_relaxed);
+		}
+	});
+}
+
+/* ************************************************************************* */
+void ConcurrentUnionFind::Export(UnionFind& sets)
+{
+	CV_Assert(static_cast<int>(sets.parent.size()) == num);
+
+	// no union runs any more, so pointing every element at its root in place is safe
+	ParallelFor(cv::Range(0, num), [&](const cv::Range& range)
+	{
+		for (int i = range.start; i < range.end; i++) {
+			parent[i].store(find(i), std::memory_order_relaxed);
+		}
+	});
+
+	int num_sets = 0;
+	for (int i = 0; i < num; i++) {
+		if (parent[i].load(std::memory_order_relaxed) == i) {
+			sets.parent[i] = 0;
+			num_sets++;
+		}
+	}
+	for (int i = 0; i < num; i++) {
+		// sizes are accumulated negatively in the roots
+		const int root = parent[i].load(std::memory_order_relaxed);
+		sets.parent[root]--;
+		if (root != i) {
+			sets.parent[i] = root;
+		}
+	}
+	sets.num = num_sets;
+}
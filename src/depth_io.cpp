@@ -0,0 +1,221 @@
+/**
+* @file depth_io.cpp
+* @brief Compact binary container of 16-bit depth maps, read through a memory mapping
+*/
+
+#include "depth_io.h"
+
+#include <climits>
+#include <cstring>
+#include <fstream>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* ************************************************************************* */
+int WriteDepthFile(const std::string& file_name, const std::vector<cv::Mat>& frames)
+{
+	if (frames.empty())
+	{
+		return 1;
+	}
+	for (size_t i = 0; i < frames.size(); ++i)
+	{
+		if (CV_16UC1 != frames[i].type() || frames[i].size() != frames[0].size() || frames[i].empty())
+		{
+			return 1;
+		}
+	}
+
+	std::ofstream out(file_name.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out.is_open())
+	{
+		return 1;
+	}
+
+	DepthFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DEPTH_FILE_MAGIC, sizeof(header.magic));
+	header.version = DEPTH_FILE_VERSION;
+	header.rows = frames[0].rows;
+	header.cols = frames[0].cols;
+	header.num_frames = static_cast<unsigned int>(frames.size());
+	header.data_offset = DEPTH_FILE_DATA_OFFSET;
+
+	char padding[DEPTH_FILE_DATA_OFFSET];
+	memset(padding, 0, sizeof(padding));
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(padding, DEPTH_FILE_DATA_OFFSET - sizeof(header));
+
+	const std::streamsize row_bytes = static_cast<std::streamsize>(header.cols) * sizeof(ushort);
+	for (size_t i = 0; i < frames.size(); ++i)
+	{
+		for (int y = 0; y < frames[i].rows; ++y)
+		{
+			out.write(reinterpret_cast<const char*>(frames[i].ptr<ushort>(y)), row_bytes);
+		}
+	}
+
+	return out.good() ? 0 : 1;
+}
+
+/* ************************************************************************* */
+DepthFile::DepthFile() : mapping(0), mapping_size(0), frames(0), frame_size(0, 0), data_offset(0)
+{
+#if defined(_WIN32)
+	file_handle = INVALID_HANDLE_VALUE;
+	mapping_handle = 0;
+#endif
+}
+
+/* ************************************************************************* */
+DepthFile::~DepthFile()
+{
+	Close();
+}
+
+/* ************************************************************************* */
+int DepthFile::Open(const std::string& file_name)
+{
+	Close();
+
+#if defined(_WIN32)
+	file_handle = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+							  FILE_ATTRIBUTE_NORMAL, 0);
+	if (INVALID_HANDLE_VALUE == file_handle)
+	{
+		return 1;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart < static_cast<LONGLONG>(sizeof(DepthFileHeader)))
+	{
+		Close();
+		return 1;
+	}
+	mapping_size = static_cast<size_t>(file_size.QuadPart);
+	mapping_handle = CreateFileMappingA(file_handle, 0, PAGE_WRITECOPY, 0, 0, 0);
+	mapping = mapping_handle ? MapViewOfFile(mapping_handle, FILE_MAP_COPY, 0, 0, 0) : 0;
+	if (0 == mapping)
+	{
+		Close();
+		return 1;
+	}
+#else
+	const int fd = open(file_name.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return 1;
+	}
+	struct stat file_stat;
+	if (0 != fstat(fd, &file_stat) || file_stat.st_size < static_cast<off_t>(sizeof(DepthFileHeader)))
+	{
+		close(fd);
+		return 1;
+	}
+	mapping_size = static_cast<size_t>(file_stat.st_size);
+	mapping = mmap(0, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == mapping)
+	{
+		mapping = 0;
+		mapping_size = 0;
+		return 1;
+	}
+#endif
+
+	DepthFileHeader header;
+	memcpy(&header, mapping, sizeof(header));
+	const size_t frame_bytes = static_cast<size_t>(header.rows) * header.cols * sizeof(ushort);
+	if (0 != memcmp(header.magic, DEPTH_FILE_MAGIC, sizeof(header.magic)) ||
+		DEPTH_FILE_VERSION != header.version || header.data_offset < sizeof(header) ||
+		0 != header.data_offset % sizeof(ushort) ||
+		0 == header.rows || 0 == header.cols || header.rows > INT_MAX / header.cols ||
+		header.data_offset > mapping_size ||
+		static_cast<size_t>(header.num_frames) > (mapping_size - header.data_offset) / frame_bytes)
+	{
+		Close();
+		return 1;
+	}
+
+	frames = static_cast<int>(header.num_frames);
+	frame_size = cv::Size(header.cols, header.rows);
+	data_offset = header.data_offset;
+
+	return 0;
+}
+
+/* ************************************************************************* */
+void DepthFile::Close()
+{
+#if defined(_WIN32)
+	if (mapping)
+	{
+		UnmapViewOfFile(mapping);
+	}
+	if (mapping_handle)
+	{
+		CloseHandle(mapping_handle);
+	}
+	if (INVALID_HANDLE_VALUE != file_handle)
+	{
+		CloseHandle(file_handle);
+	}
+	file_handle = INVALID_HANDLE_VALUE;
+	mapping_handle = 0;
+#else
+	if (mapping)
+	{
+		munmap(mapping, mapping_size);
+	}
+#endif
+	mapping = 0;
+	mapping_size = 0;
+	frames = 0;
+	frame_size = cv::Size(0, 0);
+	data_offset = 0;
+}
+
+/* ************************************************************************* */
+cv::Mat DepthFile::frame(const int idx) const
+{
+	if (idx < 0 || idx >= frames)
+	{
+		return cv::Mat();
+	}
+
+	const size_t frame_bytes = static_cast<size_t>(frame_size.area()) * sizeof(ushort);
+	uchar* data = static_cast<uchar*>(mapping) + data_offset + frame_bytes * idx;
+
+	return cv::Mat(frame_size.height, frame_size.width, CV_16UC1, data);
+}
+
+/* ************************************************************************* */
+int LoadDepthMap(const std::string& file_name, DepthFile& depth_file, cv::Mat& depth)
+{
+	if (0 == depth_file.Open(file_name))
+	{
+		depth = depth_file.frame(0);
+		return depth.empty() ? 1 : 0;
+	}
+
+	cv::FileStorage depth_data(file_name, cv::FileStorage::READ);
+	if (!depth_data.isOpened())
+	{
+		return 1;
+	}
+	cv::Mat data;
+	depth_data["data"] >> data;
+	if (CV_64FC1 != data.type())
+	{
+		return 1;
+	}
+	data.convertTo(depth, CV_16UC1);
+
+	return 0;
+}
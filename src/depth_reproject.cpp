@@ -0,0 +1,261 @@
+/**
+* @file depth_reproject.cpp
+* @brief Reproject the depth map of the depth sensor into the image plane of the color camera.
+*        The pixel offsets come from per-column and per-row tables and two pixels are projected
+*        per SSE2 step, with the operations of the legacy matrix product in the same order so
+*        the result stays bit compatible with it.
+*/
+
+#include "depth_reproject.h"
+
+#include <climits>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/core/utility.hpp"
+
+#include "work_stealing_pool.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* ************************************************************************* */
+/**
+* @brief:                       truncate like cvttsd2si, out of range values give INT_MIN
+* @param  value:                value to be truncated
+* @return:                      truncated value
+*/
+static inline int TruncateToInt(const double value)
+{
+	if (value > -2147483649.0 && value < 2147483648.0)
+	{
+		return static_cast<int>(value);
+	}
+	return INT_MIN;
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       clamp a rounded image coordinate into [0, max_idx]
+* @param  value:                coordinate plus 0.5
+* @param  max_idx:              largest valid index
+* @return:                      clamped index
+*/
+static inline int ClampToIndex(double value, const double max_idx)
+{
+	if (!(value > 0.0)) value = 0.0;
+	if (!(value < max_idx)) value = max_idx;
+	return static_cast<int>(value);
+}
+
+/* ************************************************************************* */
+RigCalibration GetDefaultRigCalibration(void)
+{
+	RigCalibration calibration;
+	// Kinect
+	calibration.depth_fx = 583.9147;	calibration.depth_fy = 586.7294;
+	calibration.depth_u0 = 328.9980;	calibration.depth_v0 = 251.6837;
+	// Pentax
+	calibration.color_fx = 810.1948;	calibration.color_fy = 814.2451;
+	calibration.color_u0 = 329.0910;	calibration.color_v0 = 244.0002;
+	// extrinsic parameters
+	const double rotation[9] = { 0.9997,	0.0200,		0.0158,
+								-0.0200,	0.9998,		0.0035,
+								-0.0157,	-0.0038,	0.9999 };
+	const double translation[3] = { 10, 53.8973, 40.4947 };	// 1.6944, 53.8973, 40.4947
+																// 10, 53.8973, 40.4947
+	for (int i = 0; i < 9; ++i) calibration.rotation[i] = rotation[i];
+	for (int i = 0; i < 3; ++i) calibration.translation[i] = translation[i];
+
+	return calibration;
+}
+
+/* ************************************************************************* */
+DepthReprojector::DepthReprojector(const RigCalibration& calibration)
+	: calib(calibration), table_width(0), table_height(0)
+{
+}
+
+/* ************************************************************************* */
+DepthReprojector::~DepthReprojector()
+{
+
+}
+
+/* ************************************************************************* */
+void DepthReprojector::SetCalibration(const RigCalibration& calibration)
+{
+	calib = calibration;
+	table_width = 0;
+	table_height = 0;
+}
+
+/* ************************************************************************* */
+void DepthReprojector::BuildTables(const int width, const int height)
+{
+	col_offset.resize(width);
+	for (int col_idx = 0; col_idx < width; ++col_idx)
+	{
+		col_offset[col_idx] = col_idx - calib.depth_u0;
+	}
+
+	row_offset.resize(height);
+	for (int row_idx = 0; row_idx < height; ++row_idx)
+	{
+		row_offset[row_idx] = row_idx - calib.depth_v0;
+	}
+
+	target_idx.resize(static_cast<size_t>(width) * height);
+	target_depth.resize(static_cast<size_t>(width) * height);
+
+	table_width = width;
+	table_height = height;
+}
+
+/* ************************************************************************* */
+void DepthReprojector::ProjectRows(const cv::Mat& src_depth, const int row_begin, const int row_end)
+{
+	// legacy order:  x = (u - u0) * z / fx,  y = (v - v0) * z / fy,
+	//                P = (r0 * x + r1 * y + r2 * z) + t,  col = (Px / Pz) * fx' + u0' + 0.5
+	const int width = table_width;
+	const double max_col = static_cast<double>(width - 1);
+	const double max_row = static_cast<double>(table_height - 1);
+	const double* r = calib.rotation;
+	const double* t = calib.translation;
+	const double depth_fx = calib.depth_fx;
+	const double depth_fy = calib.depth_fy;
+	const double color_fx = calib.color_fx;
+	const double color_fy = calib.color_fy;
+	const double u0 = calib.color_u0;
+	const double v0 = calib.color_v0;
+
+	for (int row_idx = row_begin; row_idx < row_end; ++row_idx)
+	{
+		const ushort* ptr_raw_depth_img = src_depth.ptr<ushort>(row_idx);
+		int* ptr_target_idx = &target_idx[static_cast<size_t>(row_idx) * width];
+		ushort* ptr_target_depth = &target_depth[static_cast<size_t>(row_idx) * width];
+		const double b = row_offset[row_idx];
+
+		int col_idx = 0;
+#if defined(__SSE2__)
+		const __m128d v_b = _mm_set1_pd(b);
+		const __m128d v_depth_fx = _mm_set1_pd(depth_fx), v_depth_fy = _mm_set1_pd(depth_fy);
+		const __m128d v_r0 = _mm_set1_pd(r[0]), v_r1 = _mm_set1_pd(r[1]), v_r2 = _mm_set1_pd(r[2]);
+		const __m128d v_r3 = _mm_set1_pd(r[3]), v_r4 = _mm_set1_pd(r[4]), v_r5 = _mm_set1_pd(r[5]);
+		const __m128d v_r6 = _mm_set1_pd(r[6]), v_r7 = _mm_set1_pd(r[7]), v_r8 = _mm_set1_pd(r[8]);
+		const __m128d v_tx = _mm_set1_pd(t[0]), v_ty = _mm_set1_pd(t[1]), v_tz = _mm_set1_pd(t[2]);
+		const __m128d v_color_fx = _mm_set1_pd(color_fx), v_color_fy = _mm_set1_pd(color_fy);
+		const __m128d v_u0 = _mm_set1_pd(u0), v_v0 = _mm_set1_pd(v0), v_half = _mm_set1_pd(0.5);
+		const __m128d v_zero = _mm_setzero_pd();
+		const __m128d v_max_col = _mm_set1_pd(max_col), v_max_row = _mm_set1_pd(max_row);
+
+		for (; col_idx + 2 <= width; col_idx += 2)
+		{
+			const __m128d z = _mm_cvtepi32_pd(_mm_set_epi32(0, 0, ptr_raw_depth_img[col_idx + 1],
+																 ptr_raw_depth_img[col_idx]));
+			const __m128d x = _mm_div_pd(_mm_mul_pd(_mm_loadu_pd(&col_offset[col_idx]), z), v_depth_fx);
+			const __m128d y = _mm_div_pd(_mm_mul_pd(v_b, z), v_depth_fy);
+
+			const __m128d x_color = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(v_r0, x), _mm_mul_pd(v_r1, y)),
+														  _mm_mul_pd(v_r2, z)), v_tx);
+			const __m128d y_color = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(v_r3, x), _mm_mul_pd(v_r4, y)),
+														  _mm_mul_pd(v_r5, z)), v_ty);
+			const __m128d z_color = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(v_r6, x), _mm_mul_pd(v_r7, y)),
+														  _mm_mul_pd(v_r8, z)), v_tz);
+
+			__m128d color_col = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_div_pd(x_color, z_color), v_color_fx), v_u0), v_half);
+			__m128d color_row = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_div_pd(y_color, z_color), v_color_fy), v_v0), v_half);
+			color_col = _mm_min_pd(_mm_max_pd(color_col, v_zero), v_max_col);
+			color_row = _mm_min_pd(_mm_max_pd(color_row, v_zero), v_max_row);
+
+			int cols[4], rows[4], depths[4];
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(cols), _mm_cvttpd_epi32(color_col));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(rows), _mm_cvttpd_epi32(color_row));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(depths), _mm_cvttpd_epi32(z_color));
+
+			ptr_target_idx[col_idx] = rows[0] * width + cols[0];
+			ptr_target_idx[col_idx + 1] = rows[1] * width + cols[1];
+			ptr_target_depth[col_idx] = static_cast<ushort>(depths[0]);
+			ptr_target_depth[col_idx + 1] = static_cast<ushort>(depths[1]);
+		}
+#endif
+		for (; col_idx < width; ++col_idx)
+		{
+			const double z = static_cast<double>(ptr_raw_depth_img[col_idx]);
+			const double x = col_offset[col_idx] * z / depth_fx;
+			const double y = b * z / depth_fy;
+
+			const double x_color = r[0] * x + r[1] * y + r[2] * z + t[0];
+			const double y_color = r[3] * x + r[4] * y + r[5] * z + t[1];
+			const double z_color = r[6] * x + r[7] * y + r[8] * z + t[2];
+
+			const int color_col = ClampToIndex((x_color / z_color) * color_fx + u0 + 0.5, max_col);
+			const int color_row = ClampToIndex((y_color / z_color) * color_fy + v0 + 0.5, max_row);
+
+			ptr_target_idx[col_idx] = color_row * width + color_col;
+			ptr_target_depth[col_idx] = static_cast<ushort>(TruncateToInt(z_color));
+		}
+	}
+}
+
+/* ************************************************************************* */
+int DepthReprojector::Reproject(const cv::Mat& src_depth, cv::Mat& depth_for_color, const int mode)
+{
+	if (src_depth.empty() || CV_16UC1 != src_depth.type())
+	{
+		return 1;
+	}
+
+	const int depth_map_height = src_depth.rows;
+	const int depth_map_width = src_depth.cols;
+
+	if (depth_map_width != table_width || depth_map_height != table_height)
+	{
+		BuildTables(depth_map_width, depth_map_height);
+	}
+
+	// projection is independent per pixel
+	ParallelFor(cv::Range(0, depth_map_height), [&](const cv::Range& range)
+	{
+		ProjectRows(src_depth, range.start, range.end);
+	});
+
+	// scatter in raster order so that collisions resolve deterministically
+	depth_for_color.create(depth_map_height, depth_map_width, CV_16UC1);
+	depth_for_color.setTo(0);
+	CV_Assert(depth_for_color.isContinuous());
+	ushort* ptr_depth_for_color = depth_for_color.ptr<ushort>(0);
+	const int* ptr_target_idx = &target_idx[0];
+	const ushort* ptr_target_depth = &target_depth[0];
+	const size_t num_pixels = static_cast<size_t>(depth_map_width) * depth_map_height;
+
+	if (REPROJECT_Z_BUFFER == mode)
+	{
+		for (int row_idx = 0; row_idx < depth_map_height; ++row_idx)
+		{
+			const ushort* ptr_raw_depth_img = src_depth.ptr<ushort>(row_idx);
+			const size_t offset = static_cast<size_t>(row_idx) * depth_map_width;
+			for (int col_idx = 0; col_idx < depth_map_width; ++col_idx)
+			{
+				// pixels without a depth measurement must not occlude anything
+				const ushort value = ptr_target_depth[offset + col_idx];
+				if (0 == ptr_raw_depth_img[col_idx] || 0 == value) continue;
+
+				ushort& stored = ptr_depth_for_color[ptr_target_idx[offset + col_idx]];
+				if (0 == stored || value < stored)
+				{
+					stored = value;
+				}
+			}
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < num_pixels; ++i)
+		{
+			ptr_depth_for_color[ptr_target_idx[i]] = ptr_target_depth[i];
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,240 @@
+/**
+* @file diagnostics.cpp
+* @brief Opt-in debug image output with a background writer thread
+*/
+
+#include "diagnostics.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgcodecs.hpp"
+#ifndef DIAG_HEADLESS
+#include "opencv2/highgui.hpp"
+#endif
+
+// images waiting to be encoded, the producer blocks when the queue is full
+#define DIAG_QUEUE_CAPACITY		16
+
+typedef struct DiagJob
+{
+	std::string file_name;
+	cv::Mat img;
+} DiagJob;
+
+static std::atomic<int> diag_level(DIAG_OFF);
+static std::atomic<bool> diag_headless(false);
+
+/* ************************************************************************* */
+/**
+* @brief Background writer, started on the first queued image and drained at exit
+*/
+class DiagWriter{
+public:
+	DiagWriter() : pending(0), stop(false) {}
+	~DiagWriter();
+
+	void SetOutputDir(const std::string& dir);
+	void Push(const std::string& file_name, const cv::Mat& img);
+	void Flush();
+
+private:
+	void Run();
+
+private:
+	std::mutex mutex;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+	std::condition_variable drained;
+	std::deque<DiagJob> jobs;
+	// queued plus currently being written
+	int pending;
+	bool stop;
+	std::string output_dir;
+	std::thread worker;
+};
+
+/* ************************************************************************* */
+DiagWriter::~DiagWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	not_empty.notify_all();
+	if (worker.joinable())
+	{
+		worker.join();
+	}
+}
+
+/* ************************************************************************* */
+void DiagWriter::SetOutputDir(const std::string& dir)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	output_dir = dir;
+	if (!output_dir.empty() && '/' != output_dir[output_dir.size() - 1])
+	{
+		output_dir += '/';
+	}
+}
+
+/* ************************************************************************* */
+void DiagWriter::Push(const std::string& file_name, const cv::Mat& img)
+{
+	DiagJob job;
+	job.img = img.clone();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	job.file_name = output_dir + file_name;
+	if (!worker.joinable())
+	{
+		worker = std::thread(&DiagWriter::Run, this);
+	}
+	not_full.wait(lock, [this] { return jobs.size() < DIAG_QUEUE_CAPACITY; });
+	jobs.push_back(job);
+	++pending;
+	lock.unlock();
+	not_empty.notify_one();
+}
+
+/* ************************************************************************* */
+void DiagWriter::Flush()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	drained.wait(lock, [this] { return 0 == pending; });
+}
+
+/* ************************************************************************* */
+void DiagWriter::Run()
+{
+	for (;;)
+	{
+		DiagJob job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			not_empty.wait(lock, [this] { return stop || !jobs.empty(); });
+			if (jobs.empty())
+			{
+				return;
+			}
+			job = jobs.front();
+			jobs.pop_front();
+		}
+		not_full.notify_one();
+
+		if (!cv::imwrite(job.file_name, job.img))
+		{
+			std::cout << "Can not write " << job.file_name << std::endl;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			--pending;
+		}
+		drained.notify_all();
+	}
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       get the process wide writer
+* @return:                      writer
+*/
+static DiagWriter& GetDiagWriter(void)
+{
+	static DiagWriter writer;
+	return writer;
+}
+
+/* ************************************************************************* */
+void SetDiagLevel(const int level)
+{
+	diag_level = level;
+}
+
+/* ************************************************************************* */
+int GetDiagLevel(void)
+{
+	return diag_level;
+}
+
+/* ************************************************************************* */
+bool DiagEnabled(const int level)
+{
+	return DIAG_OFF != level && level <= diag_level.load(std::memory_order_relaxed);
+}
+
+/* ************************************************************************* */
+void SetDiagHeadless(const bool headless)
+{
+	diag_headless = headless;
+}
+
+/* ************************************************************************* */
+bool IsDiagHeadless(void)
+{
+#ifdef DIAG_HEADLESS
+	return true;
+#else
+	return diag_headless;
+#endif
+}
+
+/* ************************************************************************* */
+void SetDiagOutputDir(const std::string& dir)
+{
+	GetDiagWriter().SetOutputDir(dir);
+}
+
+/* ************************************************************************* */
+int DiagWriteImage(const int level, const std::string& file_name, const cv::Mat& img)
+{
+	if (!DiagEnabled(level))
+	{
+		return 0;
+	}
+	if (img.empty())
+	{
+		return 1;
+	}
+
+	GetDiagWriter().Push(file_name, img);
+
+	return 0;
+}
+
+/* ************************************************************************* */
+int DiagShowImage(const int level, const std::string& window_name, const cv::Mat& img,
+				  const int delay)
+{
+	if (!DiagEnabled(level) || IsDiagHeadless())
+	{
+		return 0;
+	}
+	if (img.empty())
+	{
+		return 1;
+	}
+
+#ifndef DIAG_HEADLESS
+	cv::imshow(window_name, img);
+	cv::waitKey(delay);
+#else
+	(void)window_name;
+	(void)delay;
+#endif
+
+	return 0;
+}
+
+/* ************************************************************************* */
+void DiagFlush(void)
+{
+	GetDiagWriter().Flush();
+}
@@ -0,0 +1,261 @@
+/**
+* @file edge_graph.cpp
+* @brief Build and sort the compact edge graph used by the graph based segmentation
+*/
+
+#include "edge_graph.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/core/utility.hpp"
+
+#include "work_stealing_pool.h"
+
+// below this size the counting sort runs on a single thread
+#define EDGE_PARALLEL_SORT_MIN_EDGES		(1 << 18)
+
+/* ************************************************************************* */
+/**
+* @brief:		absolute difference of two pixel values
+* @param  a:	value of pixel a
+* @param  b:	value of pixel b
+* @return:		|a - b|
+*/
+template <typename WeightT, typename PixelT>
+static inline WeightT EdgeWeight(const PixelT a, const PixelT b)
+{
+	return static_cast<WeightT>(a > b ? a - b : b - a);
+}
+
+/* ************************************************************************* */
+/**
+* @brief:				call f(id, weight) for every edge leaving row y, in generation order
+* @param  depth_map:	depth map, elements of type PixelT
+* @param  y:			row
+* @param  f:			callback
+*/
+template <typename WeightT, typename PixelT, typename Func>
+static inline void ForEachRowEdge(const cv::Mat& depth_map, const int y, Func f)
+{
+	const int width = depth_map.cols;
+	const int height = depth_map.rows;
+	const PixelT* ptr_depth = depth_map.ptr<PixelT>(y);
+	const PixelT* ptr_depth_up = (y > 0) ? depth_map.ptr<PixelT>(y - 1) : 0;
+	const PixelT* ptr_depth_down = (y < height - 1) ? depth_map.ptr<PixelT>(y + 1) : 0;
+
+	for (int x = 0; x < width; x++)
+	{
+		const unsigned int id = static_cast<unsigned int>(y * width + x) << EDGE_DIRECTION_BITS;
+		const PixelT value = ptr_depth[x];
+
+		if (x < width - 1) {
+			f(id | EDGE_RIGHT, EdgeWeight<WeightT>(value, ptr_depth[x + 1]));
+		}
+		if (y < height - 1) {
+			f(id | EDGE_DOWN, EdgeWeight<WeightT>(value, ptr_depth_down[x]));
+		}
+		if ((x < width - 1) && (y < height - 1)) {
+			f(id | EDGE_DOWN_RIGHT, EdgeWeight<WeightT>(value, ptr_depth_down[x + 1]));
+		}
+		if ((x < width - 1) && (y > 0)) {
+			f(id | EDGE_UP_RIGHT, EdgeWeight<WeightT>(value, ptr_depth_up[x + 1]));
+		}
+	}
+}
+
+/* ************************************************************************* */
+template <typename WeightT>
+EdgeGraph<WeightT>::EdgeGraph() : width(0), height(0)
+{
+	offsets[EDGE_RIGHT] = 1;
+	offsets[EDGE_DOWN] = 0;
+	offsets[EDGE_DOWN_RIGHT] = 1;
+	offsets[EDGE_UP_RIGHT] = 1;
+}
+
+/* ************************************************************************* */
+template <typename WeightT>
+EdgeGraph<WeightT>::~EdgeGraph()
+{
+
+}
+
+/* ************************************************************************* */
+template <typename WeightT>
+template <typename PixelT>
+int EdgeGraph<WeightT>::Build(const cv::Mat& depth_map)
+{
+	CV_Assert(1 == depth_map.channels() && sizeof(PixelT) == depth_map.elemSize());
+
+	width = depth_map.cols;
+	height = depth_map.rows;
+
+	offsets[EDGE_RIGHT] = 1;
+	offsets[EDGE_DOWN] = width;
+	offsets[EDGE_DOWN_RIGHT] = width + 1;
+	offsets[EDGE_UP_RIGHT] = 1 - width;
+
+	if (0 == width || 0 == height)
+	{
+		edges.clear();
+		return 0;
+	}
+
+	// the number of edges of a row only depends on its position, so every row
+	// knows where its edges start and rows can be generated independently
+	row_offsets.resize(height + 1);
+	row_offsets[0] = 0;
+	for (int y = 0; y < height; y++)
+	{
+		int row_edges = width - 1;
+		if (y < height - 1) row_edges += width + (width - 1);
+		if (y > 0) row_edges += width - 1;
+		row_offsets[y + 1] = row_offsets[y] + row_edges;
+	}
+
+	edges.resize(row_offsets[height]);
+	if (edges.empty())
+	{
+		return 0;
+	}
+
+	if (std::numeric_limits<WeightT>::is_integer)
+	{
+		CountingSortEdges<PixelT>(depth_map);
+		return num_edges();
+	}
+
+	weights.resize(static_cast<size_t>(width) * height * 4);
+	ParallelFor(cv::Range(0, height), [&](const cv::Range& range)
+	{
+		for (int y = range.start; y < range.end; y++)
+		{
+			unsigned int* ptr_edges = &edges[0] + row_offsets[y];
+			int num = 0;
+			ForEachRowEdge<WeightT, PixelT>(depth_map, y, [&](const unsigned int id, const WeightT weight)
+			{
+				ptr_edges[num++] = id;
+				weights[id] = weight;
+			});
+		}
+	});
+
+	return num_edges();
+}
+
+/* ************************************************************************* */
+template <typename WeightT>
+template <typename PixelT>
+void EdgeGraph<WeightT>::CountingSortEdges(const cv::Mat& depth_map)
+{
+	const int num = num_edges();
+
+	// every chunk of rows is histogrammed and scattered by one task. Chunks are contiguous in
+	// generation order and are scattered to consecutive slots of each bucket, so the sort is
+	// stable. Weights are recomputed from the depth in every pass instead of being stored
+	int num_chunks = 1;
+	if (num >= EDGE_PARALLEL_SORT_MIN_EDGES)
+	{
+		num_chunks = std::max(1, std::min(GetParallelThreads(), num / (EDGE_PARALLEL_SORT_MIN_EDGES / 4)));
+	}
+	num_chunks = std::min(num_chunks, height);
+
+	// the largest weight bounds the histogram, depth maps are smooth so it is usually small
+	chunk_max.assign(num_chunks, 0);
+	ParallelFor(cv::Range(0, num_chunks), [&](const cv::Range& range)
+	{
+		for (int chunk = range.start; chunk < range.end; chunk++)
+		{
+			int max_weight = 0;
+			for (int y = height * chunk / num_chunks; y < height * (chunk + 1) / num_chunks; y++)
+			{
+				ForEachRowEdge<WeightT, PixelT>(depth_map, y, [&](const unsigned int, const WeightT weight)
+				{
+					max_weight = std::max(max_weight, static_cast<int>(weight));
+				});
+			}
+			chunk_max[chunk] = max_weight;
+		}
+	});
+	const int num_bins = *std::max_element(chunk_max.begin(), chunk_max.end()) + 1;
+
+	histograms.assign(static_cast<size_t>(num_bins) * num_chunks, 0);
+	ParallelFor(cv::Range(0, num_chunks), [&](const cv::Range& range)
+	{
+		for (int chunk = range.start; chunk < range.end; chunk++)
+		{
+			int* histogram = &histograms[static_cast<size_t>(chunk) * num_bins];
+			for (int y = height * chunk / num_chunks; y < height * (chunk + 1) / num_chunks; y++)
+			{
+				ForEachRowEdge<WeightT, PixelT>(depth_map, y, [&](const unsigned int, const WeightT weight)
+				{
+					histogram[static_cast<int>(weight)]++;
+				});
+			}
+		}
+	});
+
+	// exclusive prefix sum in (weight, chunk) order gives every chunk its first slot per weight
+	int total = 0;
+	for (int bin = 0; bin < num_bins; bin++)
+	{
+		for (int chunk = 0; chunk < num_chunks; chunk++)
+		{
+			int& count = histograms[static_cast<size_t>(chunk) * num_bins + bin];
+			const int slot = total;
+			total += count;
+			count = slot;
+		}
+	}
+
+	unsigned int* ptr_edges = &edges[0];
+	ParallelFor(cv::Range(0, num_chunks), [&](const cv::Range& range)
+	{
+		for (int chunk = range.start; chunk < range.end; chunk++)
+		{
+			int* slots = &histograms[static_cast<size_t>(chunk) * num_bins];
+			for (int y = height * chunk / num_chunks; y < height * (chunk + 1) / num_chunks; y++)
+			{
+				ForEachRowEdge<WeightT, PixelT>(depth_map, y, [&](const unsigned int id, const WeightT weight)
+				{
+					ptr_edges[slots[static_cast<int>(weight)]++] = id;
+				});
+			}
+		}
+	});
+}
+
+/* ************************************************************************* */
+template <typename WeightT>
+void EdgeGraph<WeightT>::SortByWeight()
+{
+	if (edges.empty())
+	{
+		return;
+	}
+
+	// edge ids grow in generation order, so breaking ties by id gives a stable order
+	const WeightT* ptr_weights = &weights[0];
+	std::sort(edges.begin(), edges.end(), [ptr_weights](const unsigned int a, const unsigned int b)
+	{
+		return (ptr_weights[a] < ptr_weights[b]) || (ptr_weights[a] == ptr_weights[b] && a < b);
+	});
+}
+
+/* ************************************************************************* */
+template <>
+void EdgeGraph<ushort>::SortByWeight()
+{
+	// Build already counting sorted the edges
+}
+
+template class EdgeGraph<ushort>;
+template class EdgeGraph<double>;
+template int EdgeGraph<ushort>::Build<ushort>(const cv::Mat& depth_map);
+template int EdgeGraph<ushort>::Build<float>(const cv::Mat& depth_map);
+template int EdgeGraph<ushort>::Build<double>(const cv::Mat& depth_map);
+template int EdgeGraph<double>::Build<ushort>(const cv::Mat& depth_map);
+template int EdgeGraph<double>::Build<float>(const cv::Mat& depth_map);
+template int EdgeGraph<double>::Build<double>(const cv::Mat& depth_map);
@@ -0,0 +1,162 @@
+/**
+* @file focus_guide.cpp
+* @brief Restrict the focus search of every region to the frames whose depth of field reaches it
+*/
+
+#include "focus_guide.h"
+
+#include <algorithm>
+#include <climits>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+/* ************************************************************************* */
+template <typename PixelT>
+static void AccumulateDepthRanges(const cv::Mat& depth_map, const cv::Mat& labels, const int num_regions,
+								  std::vector<DepthRange>& ranges)
+{
+	for (int y = 0; y < labels.rows; ++y)
+	{
+		const PixelT* ptr_depth = depth_map.ptr<PixelT>(y);
+		const int* ptr_labels = labels.ptr<int>(y);
+		for (int x = 0; x < labels.cols; ++x)
+		{
+			const int label = ptr_labels[x];
+			const double depth = static_cast<double>(ptr_depth[x]);
+			if (label < 0 || label >= num_regions || !(depth > 0))
+			{
+				continue;
+			}
+
+			DepthRange& range = ranges[label];
+			if (0 == range.min_depth || depth < range.min_depth) range.min_depth = depth;
+			if (depth > range.max_depth) range.max_depth = depth;
+		}
+	}
+}
+
+/* ************************************************************************* */
+int ComputeRegionDepthRanges(const cv::Mat& depth_map, const cv::Mat& labels, const int num_regions,
+							 std::vector<DepthRange>& ranges)
+{
+	if (CV_32SC1 != labels.type() || depth_map.size() != labels.size() || 1 != depth_map.channels() ||
+		num_regions < 0)
+	{
+		return 1;
+	}
+
+	DepthRange empty_range;
+	empty_range.min_depth = 0;
+	empty_range.max_depth = 0;
+	ranges.assign(num_regions, empty_range);
+
+	switch (depth_map.depth())
+	{
+	case CV_16U:
+		AccumulateDepthRanges<ushort>(depth_map, labels, num_regions, ranges);
+		break;
+	case CV_32F:
+		AccumulateDepthRanges<float>(depth_map, labels, num_regions, ranges);
+		break;
+	case CV_64F:
+		AccumulateDepthRanges<double>(depth_map, labels, num_regions, ranges);
+		break;
+	default:
+		return 1;
+	}
+
+	return 0;
+}
+
+/* ************************************************************************* */
+int LoadFocusDistances(const std::string& file_name, std::vector<double>& distances)
+{
+	std::ifstream sidecar(file_name.c_str());
+	if (!sidecar.is_open())
+	{
+		return 1;
+	}
+
+	distances.clear();
+	std::string line;
+	while (std::getline(sidecar, line))
+	{
+		const size_t start = line.find_first_not_of(" \t\r");
+		if (std::string::npos == start || '#' == line[start])
+		{
+			continue;
+		}
+
+		std::istringstream parser(line);
+		double distance = 0;
+		if (!(parser >> distance) || !(distance > 0))
+		{
+			distances.clear();
+			return 1;
+		}
+		distances.push_back(distance);
+	}
+
+	return distances.empty() ? 1 : 0;
+}
+
+/* ************************************************************************* */
+void MakeLinearFocusSweep(const double near_distance, const double far_distance, const int num_frames,
+						  std::vector<double>& distances)
+{
+	distances.resize(std::max(0, num_frames));
+	for (int k = 0; k < num_frames; ++k)
+	{
+		const double t = (num_frames > 1) ? static_cast<double>(k) / (num_frames - 1) : 0.0;
+		distances[k] = near_distance + (far_distance - near_distance) * t;
+	}
+}
+
+/* ************************************************************************* */
+int ComputeFrameWindows(const LensProfile& lens, const std::vector<double>& distances,
+						const std::vector<DepthRange>& ranges, const int margin,
+						std::vector<int>& first_frame, std::vector<int>& last_frame)
+{
+	const int num_frames = static_cast<int>(distances.size());
+	const int num_regions = static_cast<int>(ranges.size());
+
+	// near and far limit of the sharp zone of every frame, the far limit is unbounded at
+	// and beyond the hyperfocal distance where the back depth of field turns negative
+	std::vector<double> near_limit(num_frames);
+	std::vector<double> far_limit(num_frames);
+	for (int k = 0; k < num_frames; ++k)
+	{
+		FrontBackDOF dof = ComputeFrontBackDof(lens, distances[k]);
+		near_limit[k] = distances[k] - dof.front_dof;
+		far_limit[k] = (dof.back_dof >= 0) ? distances[k] + dof.back_dof : std::numeric_limits<double>::infinity();
+	}
+
+	first_frame.assign(num_regions, 0);
+	last_frame.assign(num_regions, INT_MAX);
+	int num_full_search = 0;
+	for (int i = 0; i < num_regions; ++i)
+	{
+		const DepthRange& range = ranges[i];
+		int first = -1;
+		int last = -1;
+		for (int k = 0; range.max_depth > 0 && k < num_frames; ++k)
+		{
+			if (near_limit[k] <= range.max_depth && far_limit[k] >= range.min_depth)
+			{
+				if (first < 0) first = k;
+				last = k;
+			}
+		}
+
+		if (first < 0)
+		{
+			num_full_search++;
+			continue;
+		}
+		first_frame[i] = std::max(0, first - std::max(0, margin));
+		last_frame[i] = std::min(num_frames - 1, last + std::max(0, margin));
+	}
+
+	return num_full_search;
+}
@@ -0,0 +1,549 @@
+/**
+* @file focus_measure.cpp
+* @brief Focus measure policies and their per-region accumulation
+*/
+
+#include "focus_measure.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// pixels handled per vector step
+#if defined(__AVX2__)
+#define FOCUS_VECTOR_WIDTH		16
+#elif defined(__SSE2__)
+#define FOCUS_VECTOR_WIDTH		8
+#else
+#define FOCUS_VECTOR_WIDTH		1
+#endif
+
+// columns whose responses are computed at a time, into a buffer on the stack
+#define FOCUS_RESPONSE_CHUNK	1024
+
+/* ************************************************************************* */
+/**
+* @brief:                       read a pixel with replicated border
+* @param  row:                  image row
+* @param  x:                    column, may be -1 or width
+* @param  width:                row width
+* @return:                      intensity
+*/
+static inline int Pixel(const uchar* row, const int x, const int width)
+{
+	return row[std::min(std::max(x, 0), width - 1)];
+}
+
+#if defined(__AVX2__)
+/* ************************************************************************* */
+/**
+* @brief:                       load 16 pixels widened to 16 bits
+* @param  ptr:                  first pixel
+* @return:                      pixels
+*/
+static inline __m256i LoadPixels(const uchar* ptr)
+{
+	return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr)));
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       store 16 signed 16-bit values widened to 32 bits
+* @param  ptr:                  destination
+* @param  value:                values
+*/
+static inline void StoreResponse(int* ptr, const __m256i value)
+{
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(ptr), _mm256_cvtepi16_epi32(_mm256_castsi256_si128(value)));
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(ptr + 8), _mm256_cvtepi16_epi32(_mm256_extracti128_si256(value, 1)));
+}
+#elif defined(__SSE2__)
+/* ************************************************************************* */
+/**
+* @brief:                       load 8 pixels widened to 16 bits
+* @param  ptr:                  first pixel
+* @return:                      pixels
+*/
+static inline __m128i LoadPixels(const uchar* ptr)
+{
+	return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(ptr)), _mm_setzero_si128());
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       store 8 signed 16-bit values widened to 32 bits
+* @param  ptr:                  destination
+* @param  value:                values
+*/
+static inline void StoreResponse(int* ptr, const __m128i value)
+{
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(ptr), _mm_srai_epi32(_mm_unpacklo_epi16(value, value), 16));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(ptr + 4), _mm_srai_epi32(_mm_unpackhi_epi16(value, value), 16));
+}
+#endif
+
+/* ************************************************************************* */
+void NormalizedVarianceMeasure::Response(const uchar* up, const uchar* row, const uchar* down,
+										 const int width, int* response)
+{
+	(void)up;
+	(void)down;
+	for (int x = 0; x < width; x++)
+	{
+		response[x] = row[x];
+	}
+}
+
+/* ************************************************************************* */
+float NormalizedVarianceMeasure::Score(const RegionStatistics& stats)
+{
+	if (0 == stats.count || 0 == stats.sum)
+	{
+		return 0.0f;
+	}
+
+	// sum((v - mean)^2) / (count * mean) = (sum_of_squares - sum * mean) / sum
+	const double mean_intensity = static_cast<double>(stats.sum) / static_cast<double>(stats.count);
+	const double squared_deviation = static_cast<double>(stats.sum_of_squares) - 
+									 static_cast<double>(stats.sum) * mean_intensity;
+
+	return static_cast<float>(squared_deviation / static_cast<double>(stats.sum));
+}
+
+/* ************************************************************************* */
+void TenengradMeasure::Response(const uchar* up, const uchar* row, const uchar* down,
+								const int width, int* response)
+{
+	int x = 1;
+#if defined(__AVX2__)
+	for (; x + FOCUS_VECTOR_WIDTH < width; x += FOCUS_VECTOR_WIDTH)
+	{
+		const __m256i ul = LoadPixels(up + x - 1), uc = LoadPixels(up + x), ur = LoadPixels(up + x + 1);
+		const __m256i ml = LoadPixels(row + x - 1), mr = LoadPixels(row + x + 1);
+		const __m256i dl = LoadPixels(down + x - 1), dc = LoadPixels(down + x), dr = LoadPixels(down + x + 1);
+
+		const __m256i gx = _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(ur, dr), _mm256_slli_epi16(mr, 1)),
+											_mm256_add_epi16(_mm256_add_epi16(ul, dl), _mm256_slli_epi16(ml, 1)));
+		const __m256i gy = _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(dl, dr), _mm256_slli_epi16(dc, 1)),
+											_mm256_add_epi16(_mm256_add_epi16(ul, ur), _mm256_slli_epi16(uc, 1)));
+
+		// interleave gx and gy so that madd gives gx * gx + gy * gy, lanes are restored afterwards
+		const __m256i lo = _mm256_unpacklo_epi16(gx, gy);
+		const __m256i hi = _mm256_unpackhi_epi16(gx, gy);
+		const __m256i g_lo = _mm256_madd_epi16(lo, lo);
+		const __m256i g_hi = _mm256_madd_epi16(hi, hi);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(response + x), _mm256_permute2x128_si256(g_lo, g_hi, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(response + x + 8), _mm256_permute2x128_si256(g_lo, g_hi, 0x31));
+	}
+#elif defined(__SSE2__)
+	for (; x + FOCUS_VECTOR_WIDTH < width; x += FOCUS_VECTOR_WIDTH)
+	{
+		const __m128i ul = LoadPixels(up + x - 1), uc = LoadPixels(up + x), ur = LoadPixels(up + x + 1);
+		const __m128i ml = LoadPixels(row + x - 1), mr = LoadPixels(row + x + 1);
+		const __m128i dl = LoadPixels(down + x - 1), dc = LoadPixels(down + x), dr = LoadPixels(down + x + 1);
+
+		const __m128i gx = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(ur, dr), _mm_slli_epi16(mr, 1)),
+										 _mm_add_epi16(_mm_add_epi16(ul, dl), _mm_slli_epi16(ml, 1)));
+		const __m128i gy = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(dl, dr), _mm_slli_epi16(dc, 1)),
+										 _mm_add_epi16(_mm_add_epi16(ul, ur), _mm_slli_epi16(uc, 1)));
+
+		// interleave gx and gy so that madd gives gx * gx + gy * gy
+		const __m128i lo = _mm_unpacklo_epi16(gx, gy);
+		const __m128i hi = _mm_unpackhi_epi16(gx, gy);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(response + x), _mm_madd_epi16(lo, lo));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(response + x + 4), _mm_madd_epi16(hi, hi));
+	}
+#endif
+
+	// borders and the tail
+	for (int i = 0; i < width; i = (0 == i && x > 1) ? x : i + 1)
+	{
+		const int gx = (Pixel(up, i + 1, width) + 2 * Pixel(row, i + 1, width) + Pixel(down, i + 1, width)) -
+					   (Pixel(up, i - 1, width) + 2 * Pixel(row, i - 1, width) + Pixel(down, i - 1, width));
+		const int gy = (Pixel(down, i - 1, width) + 2 * down[i] + Pixel(down, i + 1, width)) -
+					   (Pixel(up, i - 1, width) + 2 * up[i] + Pixel(up, i + 1, width));
+		response[i] = gx * gx + gy * gy;
+	}
+}
+
+/* ************************************************************************* */
+float TenengradMeasure::Score(const RegionStatistics& stats)
+{
+	if (0 == stats.count)
+	{
+		return 0.0f;
+	}
+
+	return static_cast<float>(static_cast<double>(stats.sum) / static_cast<double>(stats.count));
+}
+
+/* ************************************************************************* */
+void LaplacianVarianceMeasure::Response(const uchar* up, const uchar* row, const uchar* down,
+										const int width, int* response)
+{
+	int x = 1;
+#if defined(__AVX2__)
+	for (; x + FOCUS_VECTOR_WIDTH < width; x += FOCUS_VECTOR_WIDTH)
+	{
+		const __m256i neighbours = _mm256_add_epi16(_mm256_add_epi16(LoadPixels(up + x), LoadPixels(down + x)),
+													_mm256_add_epi16(LoadPixels(row + x - 1), LoadPixels(row + x + 1)));
+		StoreResponse(response + x, _mm256_sub_epi16(neighbours, _mm256_slli_epi16(LoadPixels(row + x), 2)));
+	}
+#elif defined(__SSE2__)
+	for (; x + FOCUS_VECTOR_WIDTH < width; x += FOCUS_VECTOR_WIDTH)
+	{
+		const __m128i neighbours = _mm_add_epi16(_mm_add_epi16(LoadPixels(up + x), LoadPixels(down + x)),
+												 _mm_add_epi16(LoadPixels(row + x - 1), LoadPixels(row + x + 1)));
+		StoreResponse(response + x, _mm_sub_epi16(neighbours, _mm_slli_epi16(LoadPixels(row + x), 2)));
+	}
+#endif
+
+	// borders and the tail
+	for (int i = 0; i < width; i = (0 == i && x > 1) ? x : i + 1)
+	{
+		response[i] = up[i] + down[i] + Pixel(row, i - 1, width) + Pixel(row, i + 1, width) - 4 * row[i];
+	}
+}
+
+/* ************************************************************************* */
+float LaplacianVarianceMeasure::Score(const RegionStatistics& stats)
+{
+	if (0 == stats.count)
+	{
+		return 0.0f;
+	}
+
+	const double mean = static_cast<double>(stats.sum) / static_cast<double>(stats.count);
+	const double squared_deviation = static_cast<double>(stats.sum_of_squares) - 
+									 static_cast<double>(stats.sum) * mean;
+
+	return static_cast<float>(squared_deviation / static_cast<double>(stats.count));
+}
+
+/* ************************************************************************* */
+void SumModifiedLaplacianMeasure::Response(const uchar* up, const uchar* row, const uchar* down,
+										   const int width, int* response)
+{
+	int x = 1;
+#if defined(__AVX2__)
+	for (; x + FOCUS_VECTOR_WIDTH < width; x += FOCUS_VECTOR_WIDTH)
+	{
+		const __m256i center = _mm256_slli_epi16(LoadPixels(row + x), 1);
+		const __m256i lxx = _mm256_sub_epi16(center, _mm256_add_epi16(LoadPixels(row + x - 1), LoadPixels(row + x + 1)));
+		const __m256i lyy = _mm256_sub_epi16(center, _mm256_add_epi16(LoadPixels(up + x), LoadPixels(down + x)));
+		StoreResponse(response + x, _mm256_add_epi16(_mm256_abs_epi16(lxx), _mm256_abs_epi16(lyy)));
+	}
+#elif defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + FOCUS_VECTOR_WIDTH < width; x += FOCUS_VECTOR_WIDTH)
+	{
+		const __m128i center = _mm_slli_epi16(LoadPixels(row + x), 1);
+		const __m128i lxx = _mm_sub_epi16(center, _mm_add_epi16(LoadPixels(row + x - 1), LoadPixels(row + x + 1)));
+		const __m128i lyy = _mm_sub_epi16(center, _mm_add_epi16(LoadPixels(up + x), LoadPixels(down + x)));
+		const __m128i abs_lxx = _mm_max_epi16(lxx, _mm_sub_epi16(zero, lxx));
+		const __m128i abs_lyy = _mm_max_epi16(lyy, _mm_sub_epi16(zero, lyy));
+		StoreResponse(response + x, _mm_add_epi16(abs_lxx, abs_lyy));
+	}
+#endif
+
+	// borders and the tail
+	for (int i = 0; i < width; i = (0 == i && x > 1) ? x : i + 1)
+	{
+		response[i] = std::abs(2 * row[i] - Pixel(row, i - 1, width) - Pixel(row, i + 1, width)) +
+					  std::abs(2 * row[i] - up[i] - down[i]);
+	}
+}
+
+/* ************************************************************************* */
+float SumModifiedLaplacianMeasure::Score(const RegionStatistics& stats)
+{
+	if (0 == stats.count)
+	{
+		return 0.0f;
+	}
+
+	return static_cast<float>(static_cast<double>(stats.sum) / static_cast<double>(stats.count));
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       add a row of responses to the statistics of their regions. Labels
+*                               are piecewise constant, so runs are summed before they are stored
+* @param  response:             response of every pixel
+* @param  ptr_labels:           region id of every pixel
+* @param  width:                row width
+* @param  num_regions:          number of regions
+* @param  active_regions:       regions to be accumulated, NULL for all
+* @param  stats:                statistics of every region
+*/
+template <bool squares>
+static inline void ScatterRow(const int* response, const int* ptr_labels, const int width,
+							  const int num_regions, const char* active_regions, RegionStatistics* stats)
+{
+	int x = 0;
+	while (x < width)
+	{
+		const int label = ptr_labels[x];
+		const int start = x;
+		int64 sum = 0;
+		int64 sum_of_squares = 0;
+		for (; x < width && ptr_labels[x] == label; x++)
+		{
+			sum += response[x];
+			if (squares)
+			{
+				sum_of_squares += static_cast<int64>(response[x]) * response[x];
+			}
+		}
+
+		if (label >= 0 && label < num_regions && (!active_regions || active_regions[label]))
+		{
+			stats[label].count += x - start;
+			stats[label].sum += sum;
+			stats[label].sum_of_squares += sum_of_squares;
+		}
+	}
+}
+
+/* ************************************************************************* */
+template <typename Measure>
+int AccumulateFocusStatistics(const cv::Mat& gray_img, const cv::Mat& labels, const int num_regions,
+							  std::vector<RegionStatistics>& stats)
+{
+	return AccumulateFocusStatistics<Measure>(gray_img, labels, num_regions, 0, 0, stats);
+}
+
+/* ************************************************************************* */
+template <typename Measure>
+int AccumulateFocusStatistics(const cv::Mat& gray_img, const cv::Mat& labels, const int num_regions,
+							  const char* active_regions, const char* active_rows,
+							  std::vector<RegionStatistics>& stats)
+{
+	if (CV_8UC1 != gray_img.type() || CV_32SC1 != labels.type() || gray_img.size() != labels.size() ||
+		num_regions < 0)
+	{
+		return -1;
+	}
+
+	RegionStatistics empty_stats = { 0, 0, 0 };
+	stats.assign(num_regions, empty_stats);
+	if (gray_img.empty() || 0 == num_regions)
+	{
+		return 0;
+	}
+
+	// rows are processed in chunks of columns, every chunk with one extra column on each inner
+	// side so that its neighbours are the real ones and not replicated borders. Nothing is
+	// allocated, the scan runs on the frames of the fusion steady state
+	int response[FOCUS_RESPONSE_CHUNK + 2];
+	const int width = gray_img.cols;
+	for (int y = 0; y < gray_img.rows; y++)
+	{
+		if (active_rows && !active_rows[y])
+		{
+			continue;
+		}
+
+		const uchar* up = gray_img.ptr<uchar>(std::max(y - 1, 0));
+		const uchar* row = gray_img.ptr<uchar>(y);
+		const uchar* down = gray_img.ptr<uchar>(std::min(y + 1, gray_img.rows - 1));
+		const int* ptr_labels = labels.ptr<int>(y);
+
+		for (int begin = 0; begin < width; begin += FOCUS_RESPONSE_CHUNK)
+		{
+			const int end = std::min(begin + FOCUS_RESPONSE_CHUNK, width);
+			const int x0 = std::max(begin - 1, 0);
+			const int x1 = std::min(end + 1, width);
+
+			Measure::Response(up + x0, row + x0, down + x0, x1 - x0, response);
+			ScatterRow<Measure::squares>(response + (begin - x0), ptr_labels + begin, end - begin, num_regions,
+										 active_regions, &stats[0]);
+		}
+	}
+
+	return 0;
+}
+
+/* ************************************************************************* */
+template <typename Measure>
+int AccumulateRegionFocus(const cv::Mat& gray_img, const cv::Mat& labels, const int label,
+						  const cv::Rect& roi, RegionStatistics& stats)
+{
+	if (CV_8UC1 != gray_img.type() || CV_32SC1 != labels.type() || gray_img.size() != labels.size())
+	{
+		return -1;
+	}
+
+	const cv::Rect area = roi & cv::Rect(0, 0, gray_img.cols, gray_img.rows);
+	if (area.empty())
+	{
+		return 0;
+	}
+
+	// responses are computed in chunks of columns with one extra column on each side, so the
+	// neighbours of the rectangle and of the chunks are the real ones and not replicated borders
+	int response[FOCUS_RESPONSE_CHUNK + 2];
+	for (int y = area.y; y < area.y + area.height; y++)
+	{
+		const uchar* up = gray_img.ptr<uchar>(std::max(y - 1, 0));
+		const uchar* row = gray_img.ptr<uchar>(y);
+		const uchar* down = gray_img.ptr<uchar>(std::min(y + 1, gray_img.rows - 1));
+		const int* ptr_labels = labels.ptr<int>(y);
+
+		for (int begin = area.x; begin < area.x + area.width; begin += FOCUS_RESPONSE_CHUNK)
+		{
+			const int end = std::min(begin + FOCUS_RESPONSE_CHUNK, area.x + area.width);
+			const int x0 = std::max(begin - 1, 0);
+			const int x1 = std::min(end + 1, gray_img.cols);
+
+			Measure::Response(up + x0, row + x0, down + x0, x1 - x0, response);
+			for (int x = begin; x < end; x++)
+			{
+				if (label == ptr_labels[x])
+				{
+					const int64 value = response[x - x0];
+					stats.count++;
+					stats.sum += value;
+					if (Measure::squares)
+					{
+						stats.sum_of_squares += value * value;
+					}
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* ************************************************************************* */
+template <typename Measure>
+float MeasureFocus(const cv::Mat& gray_img, const cv::Mat& mask)
+{
+	if (CV_8UC1 != mask.type() || gray_img.size() != mask.size())
+	{
+		return 0.0f;
+	}
+
+	// non-zero mask pixels form region 0
+	cv::Mat labels(mask.size(), CV_32SC1);
+	for (int y = 0; y < mask.rows; y++)
+	{
+		const uchar* ptr_mask = mask.ptr<uchar>(y);
+		int* ptr_labels = labels.ptr<int>(y);
+		for (int x = 0; x < mask.cols; x++)
+		{
+			ptr_labels[x] = ptr_mask[x] ? 0 : -1;
+		}
+	}
+
+	std::vector<RegionStatistics> stats;
+	if (0 != AccumulateFocusStatistics<Measure>(gray_img, labels, 1, stats))
+	{
+		return 0.0f;
+	}
+
+	return Measure::Score(stats[0]);
+}
+
+/* ************************************************************************* */
+int AccumulateFocusStatistics(const int measure, const cv::Mat& gray_img, const cv::Mat& labels,
+							  const int num_regions, std::vector<RegionStatistics>& stats)
+{
+	switch (measure)
+	{
+	case FOCUS_NORMALIZED_VARIANCE:
+		return AccumulateFocusStatistics<NormalizedVarianceMeasure>(gray_img, labels, num_regions, stats);
+	case FOCUS_TENENGRAD:
+		return AccumulateFocusStatistics<TenengradMeasure>(gray_img, labels, num_regions, stats);
+	case FOCUS_LAPLACIAN_VARIANCE:
+		return AccumulateFocusStatistics<LaplacianVarianceMeasure>(gray_img, labels, num_regions, stats);
+	case FOCUS_SUM_MODIFIED_LAPLACIAN:
+		return AccumulateFocusStatistics<SumModifiedLaplacianMeasure>(gray_img, labels, num_regions, stats);
+	default:
+		return -1;
+	}
+}
+
+/* ************************************************************************* */
+int AccumulateFocusStatistics(const int measure, const cv::Mat& gray_img, const cv::Mat& labels,
+							  const int num_regions, const char* active_regions, const char* active_rows,
+							  std::vector<RegionStatistics>& stats)
+{
+	switch (measure)
+	{
+	case FOCUS_NORMALIZED_VARIANCE:
+		return AccumulateFocusStatistics<NormalizedVarianceMeasure>(gray_img, labels, num_regions,
+																	active_regions, active_rows, stats);
+	case FOCUS_TENENGRAD:
+		return AccumulateFocusStatistics<TenengradMeasure>(gray_img, labels, num_regions,
+														   active_regions, active_rows, stats);
+	case FOCUS_LAPLACIAN_VARIANCE:
+		return AccumulateFocusStatistics<LaplacianVarianceMeasure>(gray_img, labels, num_regions,
+																   active_regions, active_rows, stats);
+	case FOCUS_SUM_MODIFIED_LAPLACIAN:
+		return AccumulateFocusStatistics<SumModifiedLaplacianMeasure>(gray_img, labels, num_regions,
+																	  active_regions, active_rows, stats);
+	default:
+		return -1;
+	}
+}
+
+/* ************************************************************************* */
+int AccumulateRegionFocus(const int measure, const cv::Mat& gray_img, const cv::Mat& labels,
+						  const int label, const cv::Rect& roi, RegionStatistics& stats)
+{
+	switch (measure)
+	{
+	case FOCUS_NORMALIZED_VARIANCE:
+		return AccumulateRegionFocus<NormalizedVarianceMeasure>(gray_img, labels, label, roi, stats);
+	case FOCUS_TENENGRAD:
+		return AccumulateRegionFocus<TenengradMeasure>(gray_img, labels, label, roi, stats);
+	case FOCUS_LAPLACIAN_VARIANCE:
+		return AccumulateRegionFocus<LaplacianVarianceMeasure>(gray_img, labels, label, roi, stats);
+	case FOCUS_SUM_MODIFIED_LAPLACIAN:
+		return AccumulateRegionFocus<SumModifiedLaplacianMeasure>(gray_img, labels, label, roi, stats);
+	default:
+		return -1;
+	}
+}
+
+/* ************************************************************************* */
+float FocusScore(const int measure, const RegionStatistics& stats)
+{
+	switch (measure)
+	{
+	case FOCUS_NORMALIZED_VARIANCE:
+		return NormalizedVarianceMeasure::Score(stats);
+	case FOCUS_TENENGRAD:
+		return TenengradMeasure::Score(stats);
+	case FOCUS_LAPLACIAN_VARIANCE:
+		return LaplacianVarianceMeasure::Score(stats);
+	case FOCUS_SUM_MODIFIED_LAPLACIAN:
+		return SumModifiedLaplacianMeasure::Score(stats);
+	default:
+		return 0.0f;
+	}
+}
+
+template int AccumulateFocusStatistics<NormalizedVarianceMeasure>(const cv::Mat&, const cv::Mat&, const int, std::vector<RegionStatistics>&);
+template int AccumulateFocusStatistics<TenengradMeasure>(const cv::Mat&, const cv::Mat&, const int, std::vector<RegionStatistics>&);
+template int AccumulateFocusStatistics<LaplacianVarianceMeasure>(const cv::Mat&, const cv::Mat&, const int, std::vector<RegionStatistics>&);
+template int AccumulateFocusStatistics<SumModifiedLaplacianMeasure>(const cv::Mat&, const cv::Mat&, const int, std::vector<RegionStatistics>&);
+template int AccumulateFocusStatistics<NormalizedVarianceMeasure>(const cv::Mat&, const cv::Mat&, const int, const char*, const char*, std::vector<RegionStatistics>&);
+template int AccumulateFocusStatistics<TenengradMeasure>(const cv::Mat&, const cv::Mat&, const int, const char*, const char*, std::vector<RegionStatistics>&);
+template int AccumulateFocusStatistics<LaplacianVarianceMeasure>(const cv::Mat&, const cv::Mat&, const int, const char*, const char*, std::vector<RegionStatistics>&);
+template int AccumulateFocusStatistics<SumModifiedLaplacianMeasure>(const cv::Mat&, const cv::Mat&, const int, const char*, const char*, std::vector<RegionStatistics>&);
+template int AccumulateRegionFocus<NormalizedVarianceMeasure>(const cv::Mat&, const cv::Mat&, const int, const cv::Rect&, RegionStatistics&);
+template int AccumulateRegionFocus<TenengradMeasure>(const cv::Mat&, const cv::Mat&, const int, const cv::Rect&, RegionStatistics&);
+template int AccumulateRegionFocus<LaplacianVarianceMeasure>(const cv::Mat&, const cv::Mat&, const int, const cv::Rect&, RegionStatistics&);
+template int AccumulateRegionFocus<SumModifiedLaplacianMeasure>(const cv::Mat&, const cv::Mat&, const int, const cv::Rect&, RegionStatistics&);
+template float MeasureFocus<NormalizedVarianceMeasure>(const cv::Mat&, const cv::Mat&);
+template float MeasureFocus<TenengradMeasure>(const cv::Mat&, const cv::Mat&);
+template float MeasureFocus<LaplacianVarianceMeasure>(const cv::Mat&, const cv::Mat&);
+template float MeasureFocus<SumModifiedLaplacianMeasure>(const cv::Mat&, const cv::Mat&);
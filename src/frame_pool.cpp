@@ -0,0 +1,99 @@
+/**
+* @file frame_pool.cpp
+* @brief Preallocated image buffers and allocation accounting of the fusion stage
+*/
+
+#include "frame_pool.h"
+
+#include "instrument.h"
+
+// counter of the innermost allocation scope of the calling thread
+static thread_local std::atomic<int64>* allocation_counter = 0;
+
+/* ************************************************************************* */
+void CountAllocation(void)
+{
+	std::atomic<int64>* counter = allocation_counter;
+	if (counter)
+	{
+		counter->fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+/* ************************************************************************* */
+AllocationScope::AllocationScope(std::atomic<int64>* counter) : previous(allocation_counter)
+{
+	allocation_counter = counter;
+}
+
+/* ************************************************************************* */
+AllocationScope::~AllocationScope()
+{
+	allocation_counter = previous;
+}
+
+/* ************************************************************************* */
+FramePool::FramePool() : buffer_type(-1), buffer_step(0)
+{
+
+}
+
+/* ************************************************************************* */
+FramePool::~FramePool()
+{
+
+}
+
+/* ************************************************************************* */
+int FramePool::Reserve(const cv::Size size, const int type, const int count)
+{
+	if (size.width <= 0 || size.height <= 0 || count < 0)
+	{
+		return 1;
+	}
+
+	if (size != buffer_size || type != buffer_type)
+	{
+		buffers.clear();
+		buffer_size = size;
+		buffer_type = type;
+		buffer_step = static_cast<size_t>(size.width) * CV_ELEM_SIZE(type);
+	}
+
+	while (static_cast<int>(buffers.size()) < count)
+	{
+		buffers.push_back(std::vector<uchar>(buffer_step * size.height));
+		INSTRUMENT_COUNT(COUNTER_BYTES_ALLOCATED, static_cast<int64>(buffer_step * size.height));
+	}
+
+	return 0;
+}
+
+/* ************************************************************************* */
+cv::Mat FramePool::Get(const int idx)
+{
+	CV_Assert(idx >= 0 && idx < size());
+
+	return cv::Mat(buffer_size.height, buffer_size.width, buffer_type, &buffers[idx][0], buffer_step);
+}
+
+/* ************************************************************************* */
+bool FramePool::Track(cv::Mat& mat, const int idx)
+{
+	CV_Assert(idx >= 0 && idx < size());
+
+	if (mat.data == &buffers[idx][0])
+	{
+		return true;
+	}
+
+	INSTRUMENT_COUNT(COUNTER_BYTES_ALLOCATED, static_cast<int64>(mat.total() * mat.elemSize()));
+	if (mat.size() == buffer_size && mat.type() == buffer_type)
+	{
+		cv::Mat pooled = Get(idx);
+		mat.copyTo(pooled);
+		mat = pooled;
+	}
+
+	return false;
+}
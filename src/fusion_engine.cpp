@@ -0,0 +1,631 @@
+/**
+* @file fusion_engine.cpp
+* @brief Overlap decoding of the multi-focus video with the focus statistics
+*/
+
+#include "fusion_engine.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/videoio.hpp"
+
+#include "frame_pool.h"
+#include "instrument.h"
+#include "work_stealing_pool.h"
+
+/* ************************************************************************* */
+/**
+* @brief Fixed capacity FIFO of slot indices, never allocates after construction
+*/
+class SlotQueue{
+public:
+	SlotQueue(const int capacity) : items(capacity), head(0), count(0) {}
+
+	bool empty() const { return 0 == count; }
+	int front() const { return items[head]; }
+	void pop_front() { head = (head + 1) % items.size(); --count; }
+	void push_back(const int slot) { items[(head + count) % items.size()] = slot; ++count; }
+
+private:
+	std::vector<int> items;
+	int head;
+	int count;
+};
+
+typedef struct FrameSlot
+{
+	int frame_idx;		// -1 while the slot is being filled
+	bool done;			// statistics are ready
+	cv::Mat frame;
+	cv::Mat gray;
+	cv::Mat coarse;		// gray frame at the pyramid level, if one is used
+	std::vector<RegionStatistics> stats;
+
+	// regions and rows evaluated in this frame, sized by Run so a frame does not allocate
+	std::vector<char> active_regions;
+	std::vector<char> active_rows;
+	std::vector<int> row_coverage;
+} FrameSlot;
+
+/* ************************************************************************* */
+/**
+* @brief State shared by the decoder task, the statistics tasks and the reducer of one run
+*/
+typedef struct FusionPipeline
+{
+	FusionPipeline(const int slots) : ring(slots), free_slots(slots) {}
+
+	// signalled when a frame is done, the decoder stops or a task is queued
+	std::mutex mutex;
+	std::condition_variable progress;
+
+	std::vector<FrameSlot> ring;
+	SlotQueue free_slots;
+
+	// the tasks run on this pool, the decoder is queued again whenever it ran out of slots
+	WorkStealingPool* pool;
+	cv::VideoCapture* video;
+	cv::Size frame_size;
+	int next_decode;
+	bool decoding;
+	int pending;		// tasks queued or running
+	int spawned;		// tasks queued so far
+
+	// color frames and their gray versions, one buffer per slot
+	FramePool frame_pool;
+	FramePool gray_pool;
+	FramePool coarse_pool;
+
+	// what the statistics tasks compute
+	const cv::Mat* full_labels;
+	const cv::Mat* labels;
+	int num_regions;
+	int focus_measure;
+	int pyramid_level;
+	const std::vector<char>* selected_frames;
+	const int* window_first;	// frame window of every region, null for all frames
+	const int* window_last;
+
+	// regions too small to show up on the pyramid level are measured at full resolution
+	// inside their bounding boxes
+	std::vector<int> residual_regions;
+	std::vector<cv::Rect> residual_boxes;
+
+	// regions retired by the reducer and the rows every region spans in labels
+	const std::atomic<char>* retired;
+	const std::atomic<int>* num_retired;
+	std::vector<int> first_row;
+	std::vector<int> last_row;
+
+	// allocations made for the first warm_frames frames and for the ones after them
+	int warm_frames;
+	std::atomic<int64> warm_allocations;
+	std::atomic<int64> steady_allocations;
+
+	bool decode_finished;
+	bool abort;
+	int num_frames;
+	int error;
+} FusionPipeline;
+
+/* ************************************************************************* */
+FusionEngine::FusionEngine(const int num_workers, const int ring_size)
+{
+	workers = num_workers;
+	if (workers <= 0)
+	{
+		workers = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+	}
+	slots = (ring_size > 1) ? ring_size : workers + 2;
+	steady_allocations = 0;
+	focus_measure = FOCUS_NORMALIZED_VARIANCE;
+	pyramid_level = 0;
+	num_retired = 0;
+	num_run_regions = 0;
+}
+
+/* ************************************************************************* */
+void FusionEngine::RetireRegion(const int region)
+{
+	if (retired && region >= 0 && region < num_run_regions && !retired[region].exchange(1))
+	{
+		num_retired.fetch_add(1, std::memory_order_release);
+	}
+}
+
+/* ************************************************************************* */
+FusionEngine::~FusionEngine()
+{
+
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       queue the decoder or the statistics of a frame on the pool, called
+*                               with the pipeline mutex held
+* @param  pipeline:             shared state
+* @param  slot:                 slot whose frame is evaluated, -1 for the decoder
+*/
+static void SpawnTask(FusionPipeline& pipeline, const int slot);
+
+/* ************************************************************************* */
+/**
+* @brief:                       end a task, the pipeline must not be touched afterwards since the
+*                               reducer may return as soon as the last task ended
+* @param  pipeline:             shared state
+* @param  slot:                 slot whose statistics are ready, -1 for the decoder
+*/
+static void FinishTask(FusionPipeline& pipeline, const int slot)
+{
+	std::lock_guard<std::mutex> lock(pipeline.mutex);
+	if (slot >= 0)
+	{
+		pipeline.ring[slot].done = true;
+	}
+	--pipeline.pending;
+	pipeline.progress.notify_all();
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       decode frames into free slots until the slots or the video run out,
+*                               and queue the statistics of every decoded frame
+* @param  pipeline:             shared state
+*/
+static void DecodeFrames(FusionPipeline& pipeline)
+{
+	for (;;)
+	{
+		int slot, frame_idx;
+		{
+			std::lock_guard<std::mutex> lock(pipeline.mutex);
+			if (pipeline.abort || pipeline.free_slots.empty())
+			{
+				pipeline.decoding = false;
+				break;
+			}
+			slot = pipeline.free_slots.front();
+			pipeline.free_slots.pop_front();
+			frame_idx = pipeline.next_decode++;
+			pipeline.ring[slot].frame_idx = -1;
+			pipeline.ring[slot].done = false;
+		}
+		AllocationScope frame_allocations(frame_idx < pipeline.warm_frames ? &pipeline.warm_allocations
+																		   : &pipeline.steady_allocations);
+
+		// decode straight into the pooled buffer of the slot
+		FrameSlot& frame_slot = pipeline.ring[slot];
+		frame_slot.frame = pipeline.frame_pool.Get(slot);
+		{
+			INSTRUMENT_SCOPE("decode");
+			*pipeline.video >> frame_slot.frame;
+		}
+		const bool end_of_video = frame_slot.frame.empty();
+		const bool size_mismatch = !end_of_video && (frame_slot.frame.size() != pipeline.frame_size);
+		if (!end_of_video && !size_mismatch)
+		{
+			INSTRUMENT_COUNT(COUNTER_FRAMES_DECODED, 1);
+			pipeline.frame_pool.Track(frame_slot.frame, slot);
+		}
+
+		std::lock_guard<std::mutex> lock(pipeline.mutex);
+		if (end_of_video || size_mismatch)
+		{
+			if (size_mismatch)
+			{
+				std::cout << "Frame size does not match the label map" << std::endl;
+				pipeline.error = 1;
+				pipeline.abort = true;
+			}
+			pipeline.free_slots.push_back(slot);
+			pipeline.num_frames = frame_idx;
+			pipeline.decode_finished = true;
+			pipeline.decoding = false;
+			break;
+		}
+		frame_slot.frame_idx = frame_idx;
+		SpawnTask(pipeline, slot);
+	}
+
+	FinishTask(pipeline, -1);
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       accumulate the statistics of a decoded frame
+* @param  pipeline:             shared state
+* @param  slot:                 slot of the frame
+*/
+static void ComputeStatistics(FusionPipeline& pipeline, const int slot)
+{
+	FrameSlot& frame_slot = pipeline.ring[slot];
+	const int frame_idx = frame_slot.frame_idx;
+	AllocationScope frame_allocations(frame_idx < pipeline.warm_frames ? &pipeline.warm_allocations
+																	   : &pipeline.steady_allocations);
+	std::vector<char>& active_regions = frame_slot.active_regions;
+	std::vector<char>& active_rows = frame_slot.active_rows;
+	std::vector<int>& row_coverage = frame_slot.row_coverage;
+
+	// retired regions and regions outside their frame window are skipped, and so are the
+	// rows no active region touches. The reducer ignores those regions anyway, so a stale
+	// view of the retired regions only costs time
+	const bool has_windows = (0 != pipeline.window_first);
+	const bool masked = has_windows || (pipeline.num_retired->load(std::memory_order_acquire) > 0);
+	int num_active = pipeline.num_regions;
+	if (masked)
+	{
+		num_active = 0;
+		std::fill(row_coverage.begin(), row_coverage.end(), 0);
+		for (int i = 0; i < pipeline.num_regions; ++i)
+		{
+			active_regions[i] = !pipeline.retired[i].load(std::memory_order_relaxed) &&
+				(!has_windows || (pipeline.window_first[i] <= frame_idx && frame_idx <= pipeline.window_last[i]));
+			if (active_regions[i] && pipeline.first_row[i] <= pipeline.last_row[i])
+			{
+				row_coverage[pipeline.first_row[i]]++;
+				row_coverage[pipeline.last_row[i] + 1]--;
+			}
+			num_active += active_regions[i];
+		}
+		for (int y = 0, covered = 0; y < static_cast<int>(active_rows.size()); ++y)
+		{
+			covered += row_coverage[y];
+			active_rows[y] = (covered > 0);
+		}
+	}
+
+	const std::vector<char>& selected = *pipeline.selected_frames;
+	if (0 == num_active || (!selected.empty() &&
+		(frame_idx >= static_cast<int>(selected.size()) || !selected[frame_idx])))
+	{
+		// frames that are not selected or have nothing to evaluate are only passed through
+		frame_slot.stats.clear();
+	}
+	else
+	{
+		INSTRUMENT_SCOPE("focus_evaluation");
+		INSTRUMENT_COUNT(COUNTER_FOCUS_EVALUATIONS, num_active);
+		cv::cvtColor(frame_slot.frame, frame_slot.gray, cv::COLOR_BGR2GRAY);
+		pipeline.gray_pool.Track(frame_slot.gray, slot);
+		if (pipeline.pyramid_level > 0)
+		{
+			cv::resize(frame_slot.gray, frame_slot.coarse, pipeline.labels->size(), 0, 0, cv::INTER_AREA);
+			pipeline.coarse_pool.Track(frame_slot.coarse, slot);
+		}
+		const cv::Mat& gray = (pipeline.pyramid_level > 0) ? frame_slot.coarse : frame_slot.gray;
+
+		AccumulateFocusStatistics(pipeline.focus_measure, gray, *pipeline.labels, pipeline.num_regions,
+								  masked ? &active_regions[0] : 0, masked ? &active_rows[0] : 0,
+								  frame_slot.stats);
+		for (size_t i = 0; i < pipeline.residual_regions.size(); ++i)
+		{
+			if (masked && !active_regions[pipeline.residual_regions[i]])
+			{
+				continue;
+			}
+			AccumulateRegionFocus(pipeline.focus_measure, frame_slot.gray, *pipeline.full_labels,
+								  pipeline.residual_regions[i], pipeline.residual_boxes[i],
+								  frame_slot.stats[pipeline.residual_regions[i]]);
+		}
+	}
+
+	FinishTask(pipeline, slot);
+}
+
+/* ************************************************************************* */
+static void SpawnTask(FusionPipeline& pipeline, const int slot)
+{
+	++pipeline.pending;
+	++pipeline.spawned;
+	{
+		// the deques of the pool grow by a block now and then, that memory is the pool's
+		AllocationScope scheduling(0);
+		pipeline.pool->Spawn([&pipeline, slot]()
+		{
+			if (slot < 0)
+			{
+				DecodeFrames(pipeline);
+			}
+			else
+			{
+				ComputeStatistics(pipeline, slot);
+			}
+		});
+	}
+	pipeline.progress.notify_all();
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       wait until a condition holds and run queued pool tasks meanwhile.
+*                               A reducer on a pool worker may be the only thread left to run the
+*                               tasks it waits for
+* @param  pipeline:             shared state
+* @param  ready:                condition, evaluated with the pipeline mutex held
+*/
+template <typename Ready>
+static void HelpUntil(FusionPipeline& pipeline, const Ready& ready)
+{
+	for (;;)
+	{
+		int spawned;
+		{
+			std::lock_guard<std::mutex> lock(pipeline.mutex);
+			if (ready())
+			{
+				return;
+			}
+			spawned = pipeline.spawned;
+		}
+		if (pipeline.pool->RunPendingTask())
+		{
+			continue;
+		}
+
+		// a task queued in the meantime may sit on the deque of a busy worker, so wake up for it
+		std::unique_lock<std::mutex> lock(pipeline.mutex);
+		pipeline.progress.wait(lock, [&] { return ready() || pipeline.spawned != spawned; });
+	}
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       find the regions that vanish on the pyramid level
+* @param  labels:               full resolution labels
+* @param  coarse_labels:        labels of the pyramid level
+* @param  num_regions:          number of regions
+* @param  regions:              missing regions
+* @param  boxes:                bounding boxes of the missing regions
+*/
+static void FindResidualRegions(const cv::Mat& labels, const cv::Mat& coarse_labels, const int num_regions,
+								std::vector<int>& regions, std::vector<cv::Rect>& boxes)
+{
+	std::vector<char> present(num_regions, 0);
+	for (int y = 0; y < coarse_labels.rows; ++y)
+	{
+		const int* ptr_labels = coarse_labels.ptr<int>(y);
+		for (int x = 0; x < coarse_labels.cols; ++x)
+		{
+			if (ptr_labels[x] >= 0 && ptr_labels[x] < num_regions)
+			{
+				present[ptr_labels[x]] = 1;
+			}
+		}
+	}
+
+	std::vector<cv::Rect> all_boxes(num_regions);
+	for (int y = 0; y < labels.rows; ++y)
+	{
+		const int* ptr_labels = labels.ptr<int>(y);
+		for (int x = 0; x < labels.cols; ++x)
+		{
+			const int label = ptr_labels[x];
+			if (label >= 0 && label < num_regions && !present[label])
+			{
+				all_boxes[label] = all_boxes[label] | cv::Rect(x, y, 1, 1);
+			}
+		}
+	}
+
+	regions.clear();
+	boxes.clear();
+	for (int i = 0; i < num_regions; ++i)
+	{
+		if (!present[i] && !all_boxes[i].empty())
+		{
+			regions.push_back(i);
+			boxes.push_back(all_boxes[i]);
+		}
+	}
+}
+
+/* ************************************************************************* */
+int FusionEngine::Run(const std::string& video_file_name, const cv::Mat& labels, const int num_regions,
+					  const FrameReducer& reduce)
+{
+	if (CV_32SC1 != labels.type() || num_regions <= 0)
+	{
+		return -1;
+	}
+
+	cv::VideoCapture multi_focus_video(video_file_name);
+	if(!multi_focus_video.isOpened())
+	{
+		std::cout << "Can not open " << video_file_name << std::endl;
+		return -1;
+	}
+
+	// the first frame sizes the buffers, nothing is allocated per frame afterwards
+	cv::Mat first_frame;
+	{
+		INSTRUMENT_SCOPE("decode");
+		multi_focus_video >> first_frame;
+	}
+	if (first_frame.empty())
+	{
+		steady_allocations = 0;
+		return 0;
+	}
+	INSTRUMENT_COUNT(COUNTER_FRAMES_DECODED, 1);
+	if (first_frame.size() != labels.size())
+	{
+		std::cout << "Frame size does not match the label map" << std::endl;
+		return -1;
+	}
+
+	// labels of the pyramid level, sampled at the center of every coarse pixel
+	cv::Mat coarse_labels = labels;
+	if (pyramid_level > 0)
+	{
+		const int scale = 1 << pyramid_level;
+		coarse_labels.create(std::max(1, labels.rows / scale), std::max(1, labels.cols / scale), CV_32SC1);
+		for (int y = 0; y < coarse_labels.rows; ++y)
+		{
+			const int* ptr_labels = labels.ptr<int>(std::min(y * scale + scale / 2, labels.rows - 1));
+			int* ptr_coarse_labels = coarse_labels.ptr<int>(y);
+			for (int x = 0; x < coarse_labels.cols; ++x)
+			{
+				ptr_coarse_labels[x] = ptr_labels[std::min(x * scale + scale / 2, labels.cols - 1)];
+			}
+		}
+	}
+
+	FusionPipeline pipeline(slots);
+	if (0 != pipeline.frame_pool.Reserve(first_frame.size(), first_frame.type(), slots) ||
+		0 != pipeline.gray_pool.Reserve(first_frame.size(), CV_8UC1, slots) ||
+		(pyramid_level > 0 && 0 != pipeline.coarse_pool.Reserve(coarse_labels.size(), CV_8UC1, slots)))
+	{
+		return -1;
+	}
+	pipeline.full_labels = &labels;
+	pipeline.labels = &coarse_labels;
+	if (pyramid_level > 0)
+	{
+		FindResidualRegions(labels, coarse_labels, num_regions, pipeline.residual_regions, pipeline.residual_boxes);
+	}
+
+	pipeline.first_row.assign(num_regions, coarse_labels.rows);
+	pipeline.last_row.assign(num_regions, -1);
+	for (int y = 0; y < coarse_labels.rows; ++y)
+	{
+		const int* ptr_labels = coarse_labels.ptr<int>(y);
+		for (int x = 0; x < coarse_labels.cols; ++x)
+		{
+			const int label = ptr_labels[x];
+			if (label >= 0 && label < num_regions)
+			{
+				pipeline.first_row[label] = std::min(pipeline.first_row[label], y);
+				pipeline.last_row[label] = y;
+			}
+		}
+	}
+
+	retired.reset(new std::atomic<char>[num_regions]);
+	for (int i = 0; i < num_regions; ++i)
+	{
+		retired[i].store(0, std::memory_order_relaxed);
+	}
+	num_retired = 0;
+	num_run_regions = num_regions;
+	pipeline.retired = retired.get();
+	pipeline.num_retired = &num_retired;
+	pipeline.num_regions = num_regions;
+	pipeline.focus_measure = focus_measure;
+	pipeline.pyramid_level = pyramid_level;
+	pipeline.selected_frames = &selected_frames;
+	const bool has_windows = (static_cast<int>(window_first.size()) == num_regions &&
+							  static_cast<int>(window_last.size()) == num_regions);
+	pipeline.window_first = has_windows ? &window_first[0] : 0;
+	pipeline.window_last = has_windows ? &window_last[0] : 0;
+	for (int i = 0; i < slots; ++i)
+	{
+		pipeline.ring[i].frame_idx = -1;
+		pipeline.ring[i].done = false;
+		pipeline.ring[i].frame = pipeline.frame_pool.Get(i);
+		pipeline.ring[i].gray = pipeline.gray_pool.Get(i);
+		if (pyramid_level > 0)
+		{
+			pipeline.ring[i].coarse = pipeline.coarse_pool.Get(i);
+		}
+		pipeline.ring[i].stats.reserve(num_regions);
+		pipeline.ring[i].active_regions.assign(num_regions, 1);
+		pipeline.ring[i].active_rows.assign(coarse_labels.rows, 1);
+		pipeline.ring[i].row_coverage.assign(coarse_labels.rows + 1, 0);
+		if (i > 0)
+		{
+			pipeline.free_slots.push_back(i);
+		}
+	}
+	first_frame.copyTo(pipeline.ring[0].frame);
+	pipeline.ring[0].frame_idx = 0;
+	pipeline.video = &multi_focus_video;
+	pipeline.frame_size = labels.size();
+	pipeline.next_decode = 1;
+	pipeline.pending = 0;
+	pipeline.spawned = 0;
+	pipeline.decode_finished = false;
+	pipeline.abort = false;
+	pipeline.num_frames = -1;
+	pipeline.error = 0;
+	pipeline.warm_frames = slots;
+	pipeline.warm_allocations = 0;
+	pipeline.steady_allocations = 0;
+
+	// called from a pool task the run shares that pool, otherwise it gets workers of its own.
+	// Declared after the pipeline, the workers are gone before the pipeline is destroyed
+	std::unique_ptr<WorkStealingPool> private_pool;
+	pipeline.pool = WorkStealingPool::current();
+	if (!pipeline.pool)
+	{
+		private_pool.reset(new WorkStealingPool(workers));
+		pipeline.pool = private_pool.get();
+	}
+	{
+		std::lock_guard<std::mutex> lock(pipeline.mutex);
+		SpawnTask(pipeline, 0);
+		pipeline.decoding = true;
+		SpawnTask(pipeline, -1);
+	}
+
+	// reduce in frame order, a slot is recycled only after its frame has been reduced.
+	// Once every slot has been used, the pipeline is warmed up
+	int next_frame = 0;
+	for (;;)
+	{
+		int slot = -1;
+		HelpUntil(pipeline, [&]
+		{
+			if (pipeline.abort || (pipeline.decode_finished && next_frame >= pipeline.num_frames))
+			{
+				return true;
+			}
+			for (int i = 0; i < slots; ++i)
+			{
+				if (next_frame == pipeline.ring[i].frame_idx && pipeline.ring[i].done)
+				{
+					slot = i;
+					return true;
+				}
+			}
+			return false;
+		});
+		if (slot < 0)
+		{
+			break;
+		}
+
+		const FrameSlot& frame_slot = pipeline.ring[slot];
+		const int reduced = reduce(next_frame, frame_slot.frame, frame_slot.stats);
+		++next_frame;
+		if (0 != reduced)
+		{
+			std::lock_guard<std::mutex> lock(pipeline.mutex);
+			pipeline.abort = true;
+			pipeline.error = (reduced < 0);
+			break;
+		}
+
+		// the decoder stops when it runs out of slots, the freed one starts it again
+		std::lock_guard<std::mutex> lock(pipeline.mutex);
+		pipeline.ring[slot].frame_idx = -1;
+		pipeline.free_slots.push_back(slot);
+		if (!pipeline.decoding && !pipeline.decode_finished)
+		{
+			pipeline.decoding = true;
+			SpawnTask(pipeline, -1);
+		}
+	}
+
+	// the tasks still in flight use the pipeline
+	HelpUntil(pipeline, [&pipeline] { return 0 == pipeline.pending; });
+
+	steady_allocations = pipeline.steady_allocations.load();
+
+	return pipeline.error ? -1 : next_frame;
+}
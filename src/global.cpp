@@ -1,10 +1,14 @@
 #include "global.h"
 
+#include <climits>
 #include <cmath>
 #include <memory.h>
 
-#define USHORT_MAX				0xffff	 
-#define UCHAR_MAX					0xff
+#include "opencv2/core/core.hpp"
+#include "opencv2/core/utility.hpp"
+
+#include "work_stealing_pool.h"
+
 #define	MIN_DEPTH					400     // minimum reliable depth value of Kinect
 #define MAX_DEPTH					16383   // maximum reliable depth value of Kinect
 #define UNKNOWN_DEPTH				0
@@ -21,32 +25,94 @@
 */
 unsigned char GetIntensity(int depth);
 
-// look-up table for generating log-scaled depth map for visualization
-unsigned char depth_color_table[USHORT_MAX + 1];
+/* ************************************************************************* */
+/**
+* @brief Look-up table for generating log-scaled depth map for visualization
+*/
+class DepthColorTable{
+public:
+	DepthColorTable();
+
+	unsigned char table[DEPTH_COLOR_TABLE_SIZE];
+};
 
-int InitializeDepthColorTable(void)
+/* ************************************************************************* */
+DepthColorTable::DepthColorTable()
 {
-	memset(depth_color_table, 0, USHORT_MAX + 1);
+	memset(table, 0, DEPTH_COLOR_TABLE_SIZE);
 	// set color for unknown depth
-	depth_color_table[UNKNOWN_DEPTH] = UNKNOWN_DEPTH_COLOR;
+	table[UNKNOWN_DEPTH] = UNKNOWN_DEPTH_COLOR;
 	
 	unsigned short min_reliable_depth = MIN_DEPTH;
 	unsigned short max_reliable_depth = MAX_DEPTH;
 
 	for (int depth = UNKNOWN_DEPTH + 1; depth < min_reliable_depth; depth++)
 	{
-		depth_color_table[depth] = NEAREST_COLOR;
+		table[depth] = NEAREST_COLOR;
 	}
 
 	for (unsigned short depth = min_reliable_depth; depth <= max_reliable_depth; depth++)
 	{
 		unsigned char intensity = GetIntensity(depth);
-		depth_color_table[depth] = 255 - intensity;
+		table[depth] = 255 - intensity;
 	}
+}
+
+/* ************************************************************************* */
+const unsigned char* GetDepthColorTable(void)
+{
+	// function local statics are initialized exactly once, even with concurrent callers
+	static const DepthColorTable depth_color_table;
+	return depth_color_table.table;
+}
+
+/* ************************************************************************* */
+int InitializeDepthColorTable(void)
+{
+	return (0 != GetDepthColorTable()) ? 0 : 1;
+}
+
+/* ************************************************************************* */
+int ColorizeDepth(const cv::Mat& depth, cv::Mat& depth_show)
+{
+	if (depth.empty() || CV_16UC1 != depth.type())
+	{
+		return 1;
+	}
+
+	const unsigned char* table = GetDepthColorTable();
+	depth_show.create(depth.rows, depth.cols, CV_8UC1);
+
+	ParallelFor(cv::Range(0, depth.rows), [&](const cv::Range& range)
+	{
+		for (int row_idx = range.start; row_idx < range.end; ++row_idx)
+		{
+			const ushort* ptr_depth = depth.ptr<ushort>(row_idx);
+			uchar* ptr_depth_show = depth_show.ptr<uchar>(row_idx);
+
+			int col_idx = 0;
+			for (; col_idx + 4 <= depth.cols; col_idx += 4)
+			{
+				const uchar v0 = table[ptr_depth[col_idx]];
+				const uchar v1 = table[ptr_depth[col_idx + 1]];
+				const uchar v2 = table[ptr_depth[col_idx + 2]];
+				const uchar v3 = table[ptr_depth[col_idx + 3]];
+				ptr_depth_show[col_idx] = v0;
+				ptr_depth_show[col_idx + 1] = v1;
+				ptr_depth_show[col_idx + 2] = v2;
+				ptr_depth_show[col_idx + 3] = v3;
+			}
+			for (; col_idx < depth.cols; ++col_idx)
+			{
+				ptr_depth_show[col_idx] = table[ptr_depth[col_idx]];
+			}
+		}
+	});
 
 	return 0;
 }
 
+/* ************************************************************************* */
 unsigned char GetIntensity(int depth)
 {
 	// Validate arguments
@@ -64,4 +130,4 @@ unsigned char GetIntensity(int depth)
 	return (unsigned char)(~(unsigned char)MINIMUM(
 		UCHAR_MAX,
 		log((double)(depth - MIN_DEPTH) / depthRangeScale + 1) * intensityRangeScale));
-}
\ No newline at end of file
+}
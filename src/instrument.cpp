@@ -0,0 +1,262 @@
+/**
+* @file instrument.cpp
+* @brief Scoped stage timers and event counters with Chrome trace export
+*/
+
+#include "instrument.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "opencv2/core/utility.hpp"
+
+static const char* const kCounterNames[NUM_INSTRUMENT_COUNTERS] =
+{
+	"edges", "joins", "regions", "frames_decoded", "focus_evaluations", "bytes_allocated"
+};
+
+typedef struct InstrumentEvent
+{
+	const char* name;		// timer name, null for a counter sample
+	int counter;			// counter of a sample
+	int64 start;			// ticks
+	int64 value;			// duration in ticks, or the counter total of a sample
+} InstrumentEvent;
+
+// events of one thread, the lock is only ever contended by an export
+typedef struct ThreadEvents
+{
+	int tid;
+	std::mutex mutex;
+	std::vector<InstrumentEvent> events;
+} ThreadEvents;
+
+// the registry keeps the buffers of finished threads, pool and loop threads come and go
+static std::mutex registry_mutex;
+static std::vector<std::shared_ptr<ThreadEvents> > registry;
+static thread_local std::shared_ptr<ThreadEvents> local_events;
+
+static std::atomic<int64> counters[NUM_INSTRUMENT_COUNTERS];
+static std::atomic<int64> epoch(cv::getTickCount());
+
+/* ************************************************************************* */
+/**
+* @brief:                       get the event buffer of the calling thread, registered on first use
+* @return:                      buffer
+*/
+static ThreadEvents& LocalEvents(void)
+{
+	if (!local_events)
+	{
+		local_events = std::make_shared<ThreadEvents>();
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		local_events->tid = static_cast<int>(registry.size()) + 1;
+		registry.push_back(local_events);
+	}
+
+	return *local_events;
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       append an event to the buffer of the calling thread
+* @param  event:                event
+*/
+static void Record(const InstrumentEvent& event)
+{
+	ThreadEvents& thread_events = LocalEvents();
+	std::lock_guard<std::mutex> lock(thread_events.mutex);
+	thread_events.events.push_back(event);
+}
+
+/* ************************************************************************* */
+ScopedInstrumentTimer::ScopedInstrumentTimer(const char* name) : name(name), start(cv::getTickCount())
+{
+}
+
+/* ************************************************************************* */
+ScopedInstrumentTimer::~ScopedInstrumentTimer()
+{
+	InstrumentEvent event;
+	event.name = name;
+	event.counter = -1;
+	event.start = start;
+	event.value = cv::getTickCount() - start;
+	Record(event);
+}
+
+/* ************************************************************************* */
+void InstrumentCount(const int counter, const int64 value)
+{
+	if (counter < 0 || counter >= NUM_INSTRUMENT_COUNTERS)
+	{
+		return;
+	}
+
+	InstrumentEvent event;
+	event.name = 0;
+	event.counter = counter;
+	event.start = cv::getTickCount();
+	event.value = counters[counter].fetch_add(value) + value;
+	Record(event);
+}
+
+/* ************************************************************************* */
+int64 GetInstrumentCounter(const int counter)
+{
+	if (counter < 0 || counter >= NUM_INSTRUMENT_COUNTERS)
+	{
+		return 0;
+	}
+
+	return counters[counter].load();
+}
+
+/* ************************************************************************* */
+void ResetInstrumentation(void)
+{
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	for (size_t i = 0; i < registry.size(); ++i)
+	{
+		std::lock_guard<std::mutex> events_lock(registry[i]->mutex);
+		registry[i]->events.clear();
+	}
+	for (int i = 0; i < NUM_INSTRUMENT_COUNTERS; ++i)
+	{
+		counters[i] = 0;
+	}
+	epoch = cv::getTickCount();
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       copy the events of every thread
+* @param  events:               events with the id of their thread
+*/
+static void CollectEvents(std::vector<std::pair<int, InstrumentEvent> >& events)
+{
+	events.clear();
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	for (size_t i = 0; i < registry.size(); ++i)
+	{
+		std::lock_guard<std::mutex> events_lock(registry[i]->mutex);
+		for (size_t k = 0; k < registry[i]->events.size(); ++k)
+		{
+			events.push_back(std::make_pair(registry[i]->tid, registry[i]->events[k]));
+		}
+	}
+}
+
+/* ************************************************************************* */
+int ExportChromeTrace(const std::string& file_name)
+{
+	std::vector<std::pair<int, InstrumentEvent> > events;
+	CollectEvents(events);
+
+	FILE* out = fopen(file_name.c_str(), "w");
+	if (!out)
+	{
+		return 1;
+	}
+
+	const double us_per_tick = 1e6 / cv::getTickFrequency();
+	const int64 origin = epoch.load();
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		const int tid = events[i].first;
+		const InstrumentEvent& event = events[i].second;
+		const double ts = (event.start - origin) * us_per_tick;
+		if (event.name)
+		{
+			fprintf(out, "{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f},\n",
+					event.name, tid, ts, event.value * us_per_tick);
+		}
+		else
+		{
+			fprintf(out, "{\"name\":\"%s\",\"cat\":\"counter\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"%s\":%lld}},\n",
+					kCounterNames[event.counter], tid, ts, kCounterNames[event.counter],
+					static_cast<long long>(event.value));
+		}
+	}
+	// trailing metadata event, so every event above can end with a comma
+	fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"all_in_focus\"}}\n]}\n");
+
+	const bool ok = !ferror(out);
+	fclose(out);
+
+	return ok ? 0 : 1;
+}
+
+/* ************************************************************************* */
+void PrintInstrumentSummary(std::ostream& out)
+{
+	std::vector<std::pair<int, InstrumentEvent> > events;
+	CollectEvents(events);
+
+	typedef struct TimerSummary
+	{
+		int calls;
+		int64 total;
+		int64 max;
+	} TimerSummary;
+	std::map<std::string, TimerSummary> timers;
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		const InstrumentEvent& event = events[i].second;
+		if (!event.name)
+		{
+			continue;
+		}
+		TimerSummary& summary = timers[event.name];
+		if (0 == summary.calls++)
+		{
+			summary.total = summary.max = 0;
+		}
+		summary.total += event.value;
+		summary.max = std::max(summary.max, event.value);
+	}
+
+	// most expensive first
+	std::vector<std::pair<int64, std::string> > order;
+	for (std::map<std::string, TimerSummary>::const_iterator it = timers.begin(); it != timers.end(); ++it)
+	{
+		order.push_back(std::make_pair(-it->second.total, it->first));
+	}
+	std::sort(order.begin(), order.end());
+
+	const double ms_per_tick = 1e3 / cv::getTickFrequency();
+	char line[160];
+	snprintf(line, sizeof(line), "%-24s %8s %12s %12s %12s\n", "stage", "calls", "total ms", "mean ms", "max ms");
+	out << line;
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		const TimerSummary& summary = timers[order[i].second];
+		snprintf(line, sizeof(line), "%-24s %8d %12.3f %12.3f %12.3f\n", order[i].second.c_str(), summary.calls,
+				 summary.total * ms_per_tick, summary.total * ms_per_tick / summary.calls, summary.max * ms_per_tick);
+		out << line;
+	}
+
+	snprintf(line, sizeof(line), "%-24s %16s\n", "counter", "total");
+	out << line;
+	for (int i = 0; i < NUM_INSTRUMENT_COUNTERS; ++i)
+	{
+		snprintf(line, sizeof(line), "%-24s %16lld\n", kCounterNames[i], static_cast<long long>(counters[i].load()));
+		out << line;
+	}
+}
+
+/* ************************************************************************* */
+bool IsInstrumentationEnabled(void)
+{
+#ifdef ENABLE_INSTRUMENTATION
+	return true;
+#else
+	return false;
+#endif
+}
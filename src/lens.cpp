@@ -0,0 +1,98 @@
+/**
+* @file lens.cpp
+* @brief Lens profile and depth of field tables of the camera that captured the focal stack
+*/
+
+#include "lens.h"
+
+#include <cmath>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/core/utility.hpp"
+
+#include "work_stealing_pool.h"
+
+/* ************************************************************************* */
+LensProfile MakeLensProfile(const double coc_diameter, const double aperture_value,
+							const double focal_length)
+{
+	LensProfile lens;
+	lens.coc_diameter = coc_diameter;
+	lens.aperture_value = aperture_value;
+	lens.focal_length = focal_length;
+
+	return lens;
+}
+
+/* ************************************************************************* */
+FrontBackDOF ComputeFrontBackDof(const LensProfile& lens, const double distance)
+{
+	const double fai = lens.coc_diameter;
+	const double F = lens.aperture_value;
+	const double f = lens.focal_length;
+
+	FrontBackDOF front_back_dof;
+	front_back_dof.front_dof = F * fai * pow(distance, 2) / 
+							   (pow(f, 2) + F * fai * distance);
+	front_back_dof.back_dof =  F * fai * pow(distance, 2) / 
+							   (pow(f, 2) - F * fai * distance);
+	front_back_dof.total_dof = front_back_dof.front_dof + front_back_dof.back_dof;
+
+	return front_back_dof;
+}
+
+/* ************************************************************************* */
+int CeilToInt(const double value)
+{
+	if (value != value || value <= INT_MIN)
+	{
+		return INT_MIN;
+	}
+	if (value >= INT_MAX)
+	{
+		return INT_MAX;
+	}
+
+	return static_cast<int>(ceil(value));
+}
+
+/* ************************************************************************* */
+DofTable::DofTable()
+{
+	profile = MakeLensProfile(0, 0, 0);
+}
+
+/* ************************************************************************* */
+DofTable::~DofTable()
+{
+
+}
+
+/* ************************************************************************* */
+int DofTable::Build(const LensProfile& lens)
+{
+	if (lens.coc_diameter <= 0 || lens.aperture_value <= 0 || lens.focal_length <= 0)
+	{
+		return 1;
+	}
+
+	profile = lens;
+	front_dof.resize(DOF_TABLE_SIZE);
+	back_dof.resize(DOF_TABLE_SIZE);
+	front_dof_ceil.resize(DOF_TABLE_SIZE);
+	back_dof_ceil.resize(DOF_TABLE_SIZE);
+
+	ParallelFor(cv::Range(0, DOF_TABLE_SIZE), [&](const cv::Range& range)
+	{
+		for (int distance = range.start; distance < range.end; distance++)
+		{
+			FrontBackDOF dof = ComputeFrontBackDof(profile, distance);
+			front_dof[distance] = dof.front_dof;
+			back_dof[distance] = dof.back_dof;
+			front_dof_ceil[distance] = CeilToInt(dof.front_dof);
+			back_dof_ceil[distance] = CeilToInt(dof.back_dof);
+		}
+	});
+
+	return 0;
+}
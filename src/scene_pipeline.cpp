@@ -0,0 +1,174 @@
+/**
+* @file scene_pipeline.cpp
+* @brief Run scenes through align, fill, segment and fuse, one at a time or as a batch
+*/
+
+#include "scene_pipeline.h"
+
+#include <fstream>
+#include <sstream>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include "align_fill.h"
+#include "depth_io.h"
+#include "segment.h"
+
+/* ************************************************************************* */
+SceneSettings GetDefaultSceneSettings(void)
+{
+	SceneSettings settings;
+	settings.fusion = GetDefaultFusionOptions();
+	settings.small_thresh = 10;
+	settings.tile_size = 0;
+	settings.concurrent_merge = false;
+
+	return settings;
+}
+
+/* ************************************************************************* */
+int LoadSceneManifest(const std::string& file_name, std::vector<SceneEntry>& scenes)
+{
+	std::ifstream manifest(file_name.c_str());
+	if (!manifest.is_open())
+	{
+		return 1;
+	}
+
+	scenes.clear();
+	std::string line;
+	for (int line_idx = 1; std::getline(manifest, line); ++line_idx)
+	{
+		const size_t start = line.find_first_not_of(" \t\r");
+		if (std::string::npos == start || '#' == line[start])
+		{
+			continue;
+		}
+
+		std::istringstream parser(line);
+		SceneEntry scene;
+		double coc_diameter = 0, aperture_value = 0, focal_length = 0;
+		if (!(parser >> scene.depth_file >> scene.video_file >> coc_diameter >> aperture_value >> focal_length))
+		{
+			return 1;
+		}
+		scene.lens = MakeLensProfile(coc_diameter, aperture_value, focal_length);
+		if (!(parser >> scene.output_prefix))
+		{
+			std::ostringstream prefix;
+			prefix << "scene" << line_idx << "_";
+			scene.output_prefix = prefix.str();
+		}
+		scenes.push_back(scene);
+	}
+
+	return 0;
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       milliseconds since a tick count
+* @param  start:                tick count
+* @return:                      elapsed milliseconds
+*/
+static double ElapsedMs(const int64 start)
+{
+	return (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+}
+
+/* ************************************************************************* */
+int RunScene(const SceneEntry& scene, const SceneSettings& settings, SceneResult& result)
+{
+	const int64 scene_start = cv::getTickCount();
+	result.status = 1;
+	result.num_regions = 0;
+	result.load_ms = result.align_ms = result.segment_ms = result.fuse_ms = result.total_ms = 0;
+
+	int64 start = cv::getTickCount();
+	cv::Mat depth;
+	DepthFile depth_file;
+	if (0 != LoadDepthMap(scene.depth_file, depth_file, depth))
+	{
+		return 1;
+	}
+	result.load_ms = ElapsedMs(start);
+
+	start = cv::getTickCount();
+	cv::Mat aligned_depth;
+	if (0 != AlignDepthWithColor(depth, aligned_depth))
+	{
+		return 1;
+	}
+	result.align_ms = ElapsedMs(start);
+
+	start = cv::getTickCount();
+	const LensProfile& lens = scene.lens;
+	if (lens.coc_diameter <= 0 || lens.aperture_value <= 0 || lens.focal_length <= 0)
+	{
+		return 1;
+	}
+	GraphBasedImageSeg seger(lens.coc_diameter, lens.aperture_value, lens.focal_length);
+	seger.SetTileParallel(settings.tile_size, settings.concurrent_merge);
+	cv::Mat labels, dst_color;
+	std::vector<RegionInfo> region_info;
+	result.num_regions = seger.GraphSegment(aligned_depth, settings.small_thresh, labels, region_info, dst_color);
+	result.segment_ms = ElapsedMs(start);
+	if (result.num_regions <= 0)
+	{
+		return 1;
+	}
+
+	start = cv::getTickCount();
+	cv::Mat all_in_focus_img;
+	std::vector<int> best_frames;
+	if (0 != ConstructAllInFocusImage(labels, result.num_regions, scene.video_file, settings.fusion,
+									  all_in_focus_img, best_frames))
+	{
+		return 1;
+	}
+	result.fuse_ms = ElapsedMs(start);
+
+	if (!cv::imwrite(scene.output_prefix + "segmentation_result.jpg", dst_color) ||
+		!cv::imwrite(scene.output_prefix + "all_in_focus.jpg", all_in_focus_img))
+	{
+		return 1;
+	}
+
+	result.total_ms = ElapsedMs(scene_start);
+	result.status = 0;
+
+	return 0;
+}
+
+/* ************************************************************************* */
+int RunSceneBatch(const std::vector<SceneEntry>& scenes, const SceneSettings& settings,
+				  WorkStealingPool& pool, std::vector<SceneResult>& results)
+{
+	// the fusion of every scene runs its tasks on this pool, so its worker count only sizes
+	// the ring of frame slots. Scenes in flight already keep the workers busy, a small ring
+	// per scene is enough
+	SceneSettings scene_settings = settings;
+	if (scene_settings.fusion.num_workers <= 0)
+	{
+		scene_settings.fusion.num_workers = 1;
+	}
+
+	results.assign(scenes.size(), SceneResult());
+	for (size_t i = 0; i < scenes.size(); ++i)
+	{
+		pool.Submit([&scenes, &scene_settings, &results, i]()
+		{
+			RunScene(scenes[i], scene_settings, results[i]);
+		});
+	}
+	pool.Wait();
+
+	int failures = 0;
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		failures += (0 != results[i].status);
+	}
+
+	return failures;
+}
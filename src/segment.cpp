@@ -9,27 +9,45 @@
 
 #include "segment.h"
 
+#include "concurrent_union_find.h"
+#include "instrument.h"
+#include "work_stealing_pool.h"
+
 #include "opencv2/core/core.hpp"
+#include "opencv2/core/utility.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <climits>
 #include <cassert>
 #include <cmath>
+#include <memory>
 #include <vector>
 #include <fstream>
 #include <iostream>
 
-extern unsigned char depth_color_table[USHRT_MAX + 1];
-
 #define ADD_MY_LIMIT 1
 
+// locks guarding the component roots of the concurrent stitch, a power of two
+#define MERGE_LOCK_STRIPES			1024
+// shorter runs of equal weight border edges are stitched on the calling thread
+#define CONCURRENT_MERGE_MIN_EDGES	4096
+
 /* ************************************************************************* */
 GraphBasedImageSeg::GraphBasedImageSeg(const double coc_diameter, const double aperture_value, const double focal_length)
 {
-	this->fai = coc_diameter;
-	this->F = aperture_value;
-	this->f = focal_length;
+	// an invalid lens leaves the depth of field tables empty and the segmentation fails
+	if (0 != SetLensProfile(MakeLensProfile(coc_diameter, aperture_value, focal_length)))
+	{
+		std::cout << "Invalid lens profile" << std::endl;
+	}
+	this->tile_size = 0;
+	this->concurrent_merge = false;
+	this->dirty_tile_size = 16;
+	this->change_thresh = 0;
+	ResetTemporal();
 }
 
 /* ************************************************************************* */
@@ -39,225 +57,1028 @@ GraphBasedImageSeg::~GraphBasedImageSeg()
 }
 
 /* ************************************************************************* */
-FrontBackDOF GraphBasedImageSeg::GetFrontBackDof(const double distance)
+int GraphBasedImageSeg::SetLensProfile(const LensProfile& lens)
+{
+	return dof_table.Build(lens);
+}
+
+/* ************************************************************************* */
+/**
+* @brief:					initialize the depth range of every single pixel component
+* @param  depth_map:		depth map, elements of type PixelT
+* @param  component_min:	minimum depth of each component
+* @param  component_max:	maximum depth of each component
+*/
+template <typename PixelT>
+static void InitComponentBounds(const cv::Mat& depth_map, PixelT* component_min, PixelT* component_max)
+{
+	const int width = depth_map.cols;
+	ParallelFor(cv::Range(0, depth_map.rows), [&](const cv::Range& range)
+	{
+		for (int row = range.start; row < range.end; row++)
+		{
+			const PixelT* ptr_depth_map = depth_map.ptr<PixelT>(row);
+			for (int col = 0; col < width; col++)
+			{
+				component_max[row * width + col] = ptr_depth_map[col];
+				component_min[row * width + col] = ptr_depth_map[col];
+			}
+		}
+	});
+}
+
+/* ************************************************************************* */
+/**
+* @brief:					view a workspace buffer as component bounds of type PixelT, the buffer
+*							only grows
+* @param  buffer:			workspace buffer, double aligned storage fits every pixel type
+* @param  num_vertices:		number of components
+* @return:					bounds
+*/
+template <typename PixelT>
+static PixelT* ComponentBounds(std::vector<double>& buffer, const int num_vertices)
+{
+	const size_t size = (static_cast<size_t>(num_vertices) * sizeof(PixelT) + sizeof(double) - 1) / sizeof(double);
+	if (buffer.size() < size)
+	{
+		buffer.resize(size);
+	}
+
+	return reinterpret_cast<PixelT*>(&buffer[0]);
+}
+
+/* ************************************************************************* */
+inline bool GraphBasedImageSeg::WithinDof(const double minimum, const double maximum)
+{
+	double diff = (maximum - minimum);	//mm
+
+	return (diff < dof_table.back(minimum)) || (diff < dof_table.front(maximum));
+}
+
+/* ************************************************************************* */
+inline bool GraphBasedImageSeg::WithinDof(const ushort minimum, const ushort maximum)
+{
+	// diff < t holds for an integer diff exactly when diff < ceil(t)
+	const int diff = maximum - minimum;	//mm
+
+	return (diff < dof_table.back_ceil(minimum)) || (diff < dof_table.front_ceil(maximum));
+}
+
+/* ************************************************************************* */
+template <typename PixelT>
+inline bool GraphBasedImageSeg::MergeWithinDof(UnionFind* d, int a, int b,
+											   PixelT* component_min, PixelT* component_max)
+{
+	// Depth of field constraint
+	PixelT minimum = std::min(component_min[a], component_min[b]);
+	PixelT maximum = std::max(component_max[a], component_max[b]);
+
+	if (!WithinDof(minimum, maximum))
+	{
+		return false;
+	}
+
+	d->link(a, b);
+	a = d->find(a);
+
+	// Update min and max array
+	component_min[a] = minimum;
+	component_max[a] = maximum;
+
+	return true;
+}
+
+/* ************************************************************************* */
+void GraphBasedImageSeg::SetTileParallel(const int tile_size, const bool concurrent_merge)
+{
+	this->tile_size = std::max(0, tile_size);
+	this->concurrent_merge = concurrent_merge;
+}
+
+/* ************************************************************************* */
+/**
+* @brief:				check whether every depth value is an integer that fits into 16 bits, the
+*						edge weights are then stored as ushort without losing anything
+* @param  depth_map:	depth map, elements of type PixelT
+* @return:				true if integral
+*/
+template <typename PixelT>
+static bool IsIntegralDepth(const cv::Mat& depth_map)
+{
+	if (CV_16U == depth_map.depth())
+	{
+		return true;
+	}
+
+	for (int y = 0; y < depth_map.rows; y++) {
+		const PixelT* ptr_depth_map = depth_map.ptr<PixelT>(y);
+		for (int x = 0; x < depth_map.cols; x++) {
+			const double value = ptr_depth_map[x];
+			if (!(value >= 0.0 && value <= USHRT_MAX) || value != floor(value)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/* ************************************************************************* */
+template <typename PixelT, typename WeightT>
+UnionFind *GraphBasedImageSeg::SegmentEdges(const cv::Mat& depth_map, const int small_thresh,
+										   EdgeGraph<WeightT>& graph)
+{
+	int width = depth_map.cols;
+	int height = depth_map.rows;
+
+	{
+		INSTRUMENT_SCOPE("edge_build");
+		graph.template Build<PixelT>(depth_map);
+	}
+	INSTRUMENT_COUNT(COUNTER_EDGES, graph.num_edges());
+
+	// segment the graphs
+	const bool tiled = (tile_size > 0) && (width > tile_size || height > tile_size);
+	UnionFind* d = tiled ? SegGraphTiled<PixelT>(depth_map, width * height, graph)
+						 : SegGraph<PixelT>(depth_map, width * height, graph);
+
+	// small component merging
+	{
+		INSTRUMENT_SCOPE("small_merge");
+		const int num = graph.num_edges();
+		for (int i = 0; i < num; i++) 
+		{
+			int a = d->find(graph.source(i));
+			int b = d->find(graph.target(i));
+			if ((a != b) && ((d->size(a) < small_thresh) || (d->size(b) < small_thresh))) 
+			{
+				d->join(a, b);
+			}
+		}
+	}
+	// every join removed one set
+	INSTRUMENT_COUNT(COUNTER_JOINS, width * height - d->num_sets());
+
+	return d;
+}
+
+/* ************************************************************************* */
+template <typename PixelT>
+UnionFind *GraphBasedImageSeg::SegmentDepth(const cv::Mat& depth_map, const int small_thresh)
 {
-	FrontBackDOF front_back_dof;
-	front_back_dof.front_dof = F * fai * pow(distance, 2) / 
-							   (pow(f, 2) + F * fai * distance);
-	front_back_dof.back_dof =  F * fai * pow(distance, 2) / 
-							   (pow(f, 2) - F * fai * distance);
-	front_back_dof.total_dof = front_back_dof.front_dof + front_back_dof.back_dof;
-
-	return front_back_dof;
+	// integral depth (e.g. from the 16-bit sensor) gets 2-byte weights
+	if (IsIntegralDepth<PixelT>(depth_map))
+	{
+		return SegmentEdges<PixelT>(depth_map, small_thresh, workspace.integral_graph);
+	}
+
+	return SegmentEdges<PixelT>(depth_map, small_thresh, workspace.graph);
 }
 
-inline double GraphBasedImageSeg::Dissim(const cv::Mat& depth, const int x1, const int y1, 
-										 const int x2, const int y2)
+#ifdef ENABLE_INSTRUMENTATION
+/* ************************************************************************* */
+/**
+* @brief:					get the size of the workspace buffers, the growth over a call is what it
+*							allocated
+* @param  workspace:		workspace
+* @return:					bytes
+*/
+static size_t WorkspaceBytes(const SegmentationWorkspace& workspace)
 {
-	assert(CV_64FC1 == depth.type());
+	return workspace.integral_graph.edges.capacity() * sizeof(unsigned int) +
+		   workspace.integral_graph.weights.capacity() * sizeof(ushort) +
+		   workspace.graph.edges.capacity() * sizeof(unsigned int) +
+		   workspace.graph.weights.capacity() * sizeof(double) +
+		   workspace.forest.parent.capacity() * sizeof(int) +
+		   (workspace.component_min.capacity() + workspace.component_max.capacity()) * sizeof(double) +
+		   workspace.label_of_root.capacity() * sizeof(int) +
+		   (workspace.edge_bucket.capacity() + workspace.bucketed_edges.capacity()) * sizeof(int);
+}
+#endif
 
-	const double* ptr_depth_1 = depth.ptr<double>(y1);
-	double value_1 = ptr_depth_1[x1];
-	const double* ptr_depth_2 = depth.ptr<double>(y2);
-	double value_2 = ptr_depth_2[x2];
-	double weight = abs(value_1 - value_2);
+/* ************************************************************************* */
+/**
+* @brief:					get the color of a region id, the same id always gets the same color
+* @param  label:			region id
+* @return:					color
+*/
+static cv::Vec3b LabelColor(const int label)
+{
+	unsigned int h = static_cast<unsigned int>(label) * 2654435761u;
+	h ^= h >> 15;
+	h *= 2246822519u;
+	h ^= h >> 13;
 
-	return weight;
+	return cv::Vec3b((uchar)h, (uchar)(h >> 8), (uchar)(h >> 16));
 }
 
 /* ************************************************************************* */
 int GraphBasedImageSeg::GraphSegment(const cv::Mat& depth_map, const int small_thresh, 
-									 std::vector<cv::Mat>& regions, cv::Mat& dst)
+									 cv::Mat& labels, std::vector<RegionInfo>& region_info, cv::Mat& dst)
 {
+	if (dof_table.empty())
+	{
+		return -1;
+	}
+
 	int width = depth_map.cols;
 	int height = depth_map.rows;
+	INSTRUMENT_SCOPE("segment");
+#ifdef ENABLE_INSTRUMENTATION
+	const size_t workspace_bytes = WorkspaceBytes(workspace);
+#endif
 
-	Edge *edges = new Edge[width * height * 4];
-	int num = 0;
+	// the pixel type is resolved once here, the edge loops are specialized for it
+	UnionFind* d;
+	switch (depth_map.type())
+	{
+	case CV_16UC1:
+		d = SegmentDepth<ushort>(depth_map, small_thresh);
+		break;
+	case CV_32FC1:
+		d = SegmentDepth<float>(depth_map, small_thresh);
+		break;
+	case CV_64FC1:
+		d = SegmentDepth<double>(depth_map, small_thresh);
+		break;
+	default:
+		return -1;
+	}
 
+	// relabel the components 0..R-1 in order of first appearance and mirror the labels
+	INSTRUMENT_SCOPE("relabel");
+	labels.create(height, width, CV_32SC1);
+	dst.create(height, width, CV_8UC3);
+	region_info.clear();
+	std::vector<int>& label_of_root = workspace.label_of_root;
+	label_of_root.assign(static_cast<size_t>(width) * height, -1);
 	for (int y = 0; y < height; y++) {
+		int* ptr_labels = labels.ptr<int>(y);
+		cv::Vec3b* ptr_dst = dst.ptr<cv::Vec3b>(y);
 		for (int x = 0; x < width; x++) {
+			int comp = d->find(y * width + x);
 
-			//const double* ptr_depth_map = depth_map.ptr<double>(y);
-			//double depth_val = ptr_depth_map[x];
+			int label = label_of_root[comp];
+			if (label < 0)
+			{
+				label = label_of_root[comp] = static_cast<int>(region_info.size());
+				RegionInfo info;
+				info.pixel_count = 0;
+				info.bounding_box = cv::Rect(width - 1 - x, y, 1, 1);
+				region_info.push_back(info);
+			}
+
+			const int flipped_x = width - 1 - x;
+			ptr_labels[flipped_x] = label;
 
-			if (x < width - 1) {
-				edges[num].a = y * width + x;
-				edges[num].b = y * width + (x + 1);
-				//edges[num].w = depth_val;
-				edges[num].w = Dissim(depth_map, x, y, x + 1, y);
-				num++;
+			RegionInfo& info = region_info[label];
+			info.pixel_count++;
+			cv::Rect& box = info.bounding_box;
+			if (flipped_x < box.x) {
+				box.width += box.x - flipped_x;
+				box.x = flipped_x;
 			}
-			if (y < height - 1) {
-				edges[num].a = y * width + x;
-				edges[num].b = (y + 1) * width + x;
-				//edges[num].w = depth_val;
-				edges[num].w = Dissim(depth_map, x, y, x, y + 1);
-				num++;
+			else if (flipped_x >= box.x + box.width) {
+				box.width = flipped_x - box.x + 1;
+			}
+			box.height = y - box.y + 1;
+
+			// assign color
+			ptr_dst[x] = LabelColor(label);
+		}
+	}
+	INSTRUMENT_COUNT(COUNTER_REGIONS, static_cast<int64>(region_info.size()));
+	INSTRUMENT_COUNT(COUNTER_BYTES_ALLOCATED, static_cast<int64>(WorkspaceBytes(workspace) - workspace_bytes));
+
+	return static_cast<int>(region_info.size());
+}
+
+/* ************************************************************************* */
+int GraphBasedImageSeg::GraphSegment(const cv::Mat& depth_map, const int small_thresh, 
+									 std::vector<cv::Mat>& regions, cv::Mat& dst)
+{
+	cv::Mat labels;
+	std::vector<RegionInfo> region_info;
+	int num_regions = GraphSegment(depth_map, small_thresh, labels, region_info, dst);
+
+	LabelsToRegions(labels, num_regions, regions);
+
+	return num_regions;
+}
+
+/* ************************************************************************* */
+void GraphBasedImageSeg::SetTemporal(const int dirty_tile_size, const int change_thresh)
+{
+	this->dirty_tile_size = std::max(1, dirty_tile_size);
+	this->change_thresh = std::max(0, change_thresh);
+	ResetTemporal();
+}
+
+/* ************************************************************************* */
+void GraphBasedImageSeg::ResetTemporal()
+{
+	temporal.reference_depth.release();
+	temporal.labels.clear();
+	temporal.region_min.clear();
+	temporal.region_max.clear();
+	temporal.region_size.clear();
+	temporal.free_labels.clear();
+	temporal.num_dirty_tiles = -1;
+}
+
+/* ************************************************************************* */
+void GraphBasedImageSeg::SegmentTemporalFull(const cv::Mat& depth_map, const int small_thresh)
+{
+	const int width = depth_map.cols;
+	const int num_pixels = depth_map.rows * width;
+
+	UnionFind* d = SegmentDepth<ushort>(depth_map, small_thresh);
+
+	// ids in order of first appearance, as GraphSegment numbers them
+	TemporalSegmentation& state = temporal;
+	state.labels.resize(num_pixels);
+	state.region_min.clear();
+	state.region_max.clear();
+	state.region_size.clear();
+	state.free_labels.clear();
+	std::vector<int>& label_of_root = workspace.label_of_root;
+	label_of_root.assign(num_pixels, -1);
+	for (int y = 0; y < depth_map.rows; y++) {
+		const ushort* ptr_depth_map = depth_map.ptr<ushort>(y);
+		for (int x = 0; x < width; x++) {
+			const int p = y * width + x;
+			const int comp = d->find(p);
+			const ushort value = ptr_depth_map[x];
+
+			int label = label_of_root[comp];
+			if (label < 0)
+			{
+				label = label_of_root[comp] = static_cast<int>(state.region_size.size());
+				state.region_min.push_back(value);
+				state.region_max.push_back(value);
+				state.region_size.push_back(0);
 			}
-			if ((x < width - 1) && (y < height - 1)) {
-				edges[num].a = y * width + x;
-				edges[num].b = (y + 1) * width + (x + 1);
-				//edges[num].w = depth_val;
-				edges[num].w = Dissim(depth_map, x, y, x + 1, y + 1);
-				num++;
+
+			state.labels[p] = label;
+			state.region_min[label] = std::min(state.region_min[label], value);
+			state.region_max[label] = std::max(state.region_max[label], value);
+			state.region_size[label]++;
+		}
+	}
+
+	depth_map.copyTo(state.reference_depth);
+}
+
+/* ************************************************************************* */
+void GraphBasedImageSeg::SegmentTemporalTiles(const cv::Mat& depth_map, const int small_thresh,
+											  const std::vector<char>& dirty_tiles, const int tiles_x)
+{
+	const int width = depth_map.cols;
+	const int height = depth_map.rows;
+	const int tile = dirty_tile_size;
+	TemporalSegmentation& state = temporal;
+	INSTRUMENT_SCOPE("resegment_tiles");
+
+	// number the dirty pixels and take them out of their previous regions. The depth bounds
+	// of those regions are kept, which can only make them stricter. Only the pixels of the
+	// previous dirty tiles are numbered, so only those are cleared
+	std::vector<int>& local_of_pixel = workspace.local_of_pixel;
+	std::vector<int>& dirty_pixels = workspace.dirty_pixels;
+	if (local_of_pixel.size() != static_cast<size_t>(width) * height)
+	{
+		local_of_pixel.assign(static_cast<size_t>(width) * height, -1);
+	}
+	else
+	{
+		for (size_t i = 0; i < dirty_pixels.size(); i++) {
+			local_of_pixel[dirty_pixels[i]] = -1;
+		}
+	}
+	dirty_pixels.clear();
+	for (int y = 0; y < height; y++) {
+		const char* ptr_dirty = &dirty_tiles[(y / tile) * tiles_x];
+		for (int x = 0; x < width; x++) {
+			if (!ptr_dirty[x / tile]) {
+				continue;
 			}
-			if ((x < width - 1) && (y > 0)) {
-				edges[num].a = y * width + x;
-				edges[num].b = (y - 1) * width + (x + 1);
-				//edges[num].w = depth_val;
-				edges[num].w = Dissim(depth_map, x, y, x + 1, y - 1);
-				num++;
+			const int p = y * width + x;
+			local_of_pixel[p] = static_cast<int>(dirty_pixels.size());
+			dirty_pixels.push_back(p);
+
+			const int label = state.labels[p];
+			if (0 == --state.region_size[label])
+			{
+				state.free_labels.push_back(label);
 			}
 		}
 	}
+	const int num_dirty = static_cast<int>(dirty_pixels.size());
 
-	// segment the graphs
-	//int64 time_1 = cv::getTickCount();
-	double c = 0;
-	DisJoint* d = SegGraph(depth_map, width * height, num, edges);
-	//int64 time_2 = cv::getTickCount();
-	//std::cout << "true seg time: " << (time_2 - time_1) / cv::getTickFrequency() << std::endl;
+	// 8-connected edges of the dirty pixels, each dirty pair once and every clean neighbour
+	std::vector<TemporalEdge>& edges = workspace.temporal_edges;
+	std::vector<ushort>& component_min = workspace.temporal_min;
+	std::vector<ushort>& component_max = workspace.temporal_max;
+	edges.clear();
+	component_min.resize(num_dirty);
+	component_max.resize(num_dirty);
+	for (int i = 0; i < num_dirty; i++) {
+		const int p = dirty_pixels[i];
+		const int x = p % width;
+		const int y = p / width;
+		const int value = depth_map.ptr<ushort>(y)[x];
+		component_min[i] = component_max[i] = static_cast<ushort>(value);
+
+		for (int dy = -1; dy <= 1; dy++) {
+			if (y + dy < 0 || y + dy >= height) {
+				continue;
+			}
+			const ushort* ptr_depth_map = depth_map.ptr<ushort>(y + dy);
+			for (int dx = -1; dx <= 1; dx++) {
+				if ((0 == dx && 0 == dy) || x + dx < 0 || x + dx >= width) {
+					continue;
+				}
+				const int q = p + dy * width + dx;
+				const int local = local_of_pixel[q];
+				if (local >= 0 && q < p) {
+					continue;
+				}
+
+				TemporalEdge edge;
+				edge.weight = std::abs(value - static_cast<int>(ptr_depth_map[x + dx]));
+				edge.source = i;
+				edge.target = (local >= 0) ? local : -1 - state.labels[q];
+				edges.push_back(edge);
+			}
+		}
+	}
+
+	// stable counting sort by weight, as EdgeGraph sorts 16-bit weights
+	int max_weight = 0;
+	for (size_t i = 0; i < edges.size(); i++) {
+		max_weight = std::max(max_weight, edges[i].weight);
+	}
+	std::vector<int>& histogram = workspace.temporal_histogram;
+	histogram.assign(max_weight + 2, 0);
+	for (size_t i = 0; i < edges.size(); i++) {
+		histogram[edges[i].weight + 1]++;
+	}
+	for (int w = 0; w <= max_weight; w++) {
+		histogram[w + 1] += histogram[w];
+	}
+	std::vector<TemporalEdge>& sorted_edges = workspace.temporal_sorted;
+	sorted_edges.resize(edges.size());
+	for (size_t i = 0; i < edges.size(); i++) {
+		sorted_edges[histogram[edges[i].weight]++] = edges[i];
+	}
+	edges.swap(sorted_edges);
+
+	// a component joins a clean region if the depth of field covers both, the region grows
+	UnionFind& d = workspace.temporal_forest;
+	std::vector<int>& attached = workspace.attached;
+	d.Reset(num_dirty);
+	attached.assign(num_dirty, -1);
+	auto attach = [&](const int comp, const int label, const bool check_dof)
+	{
+		const ushort minimum = std::min(component_min[comp], state.region_min[label]);
+		const ushort maximum = std::max(component_max[comp], state.region_max[label]);
+		if (check_dof && !WithinDof(minimum, maximum))
+		{
+			return;
+		}
+		attached[comp] = label;
+		state.region_min[label] = minimum;
+		state.region_max[label] = maximum;
+	};
+
+	// same order as SegGraph, two components attached to regions are never merged
+	for (size_t i = 0; i < edges.size(); i++)
+	{
+		const int a = d.find(edges[i].source);
+		if (edges[i].target < 0)
+		{
+			if (attached[a] < 0) attach(a, -1 - edges[i].target, true);
+			continue;
+		}
+
+		const int b = d.find(edges[i].target);
+		if (a == b) {
+			continue;
+		}
+		if (attached[a] < 0 && attached[b] < 0) {
+			MergeWithinDof(&d, a, b, &component_min[0], &component_max[0]);
+		}
+		else if (attached[a] < 0) {
+			attach(a, attached[b], true);
+		}
+		else if (attached[b] < 0) {
+			attach(b, attached[a], true);
+		}
+	}
 
 	// small component merging
-	for (int i = 0; i < num; i++) 
+	for (size_t i = 0; i < edges.size(); i++)
 	{
-		int a = d->find(edges[i].a);
-		int b = d->find(edges[i].b);
-		if ((a != b) && ((d->size(a) < small_thresh) || (d->size(b) < small_thresh))) 
+		const int a = d.find(edges[i].source);
+		if (edges[i].target < 0)
 		{
-			d->join(a, b);
+			if (attached[a] < 0 && d.size(a) < small_thresh) attach(a, -1 - edges[i].target, false);
+			continue;
+		}
+
+		const int b = d.find(edges[i].target);
+		if (a == b || (d.size(a) >= small_thresh && d.size(b) >= small_thresh)) {
+			continue;
+		}
+		if (attached[a] < 0 && attached[b] < 0) {
+			const ushort minimum = std::min(component_min[a], component_min[b]);
+			const ushort maximum = std::max(component_max[a], component_max[b]);
+			d.join(a, b);
+			component_min[d.find(a)] = minimum;
+			component_max[d.find(a)] = maximum;
+		}
+		else if (attached[a] < 0 && d.size(a) < small_thresh) {
+			attach(a, attached[b], false);
+		}
+		else if (attached[b] < 0 && d.size(b) < small_thresh) {
+			attach(b, attached[a], false);
 		}
 	}
 
-	delete[] edges;
+	// components left over become regions, ids of vanished regions are taken first
+	for (int i = 0; i < num_dirty; i++) {
+		const int comp = d.find(i);
+		int label = attached[comp];
+		if (label < 0)
+		{
+			if (!state.free_labels.empty())
+			{
+				label = state.free_labels.back();
+				state.free_labels.pop_back();
+				state.region_min[label] = component_min[comp];
+				state.region_max[label] = component_max[comp];
+			}
+			else
+			{
+				label = static_cast<int>(state.region_size.size());
+				state.region_min.push_back(component_min[comp]);
+				state.region_max.push_back(component_max[comp]);
+				state.region_size.push_back(0);
+			}
+			attached[comp] = label;
+		}
 
-	// random-color palette
-	// 3-by-wh 2D array
-	uchar **randClr;
-	randClr = new uchar*[width * height];
-	for (int i = 0; i < width * height; i++) {
-		randClr[i] = new uchar[3];
-		memset(randClr[i], 0, sizeof(uchar) * 3);
+		state.labels[dirty_pixels[i]] = label;
+		state.region_size[label]++;
 	}
 
-	// palette color set
-	for (int i = 0; i < width * height; i++) {
-		//uchar random_color = (uchar)rand();
-		for (int j = 0; j < 3; j++) {
-			randClr[i][j] = (uchar)rand();
+	// the re-segmented tiles are the reference of the next frame
+	for (size_t t = 0; t < dirty_tiles.size(); t++) {
+		if (dirty_tiles[t]) {
+			const int x = static_cast<int>(t % tiles_x) * tile;
+			const int y = static_cast<int>(t / tiles_x) * tile;
+			const cv::Rect rect(x, y, std::min(tile, width - x), std::min(tile, height - y));
+			cv::Mat reference_tile = state.reference_depth(rect);
+			depth_map(rect).copyTo(reference_tile);
 		}
 	}
+}
 
-	// color assignment to components
-	cv::Mat comp_matrix = cv::Mat::zeros(height, width, CV_32SC1);
-	dst = cv::Mat::zeros(height, width, CV_8UC3);
-	std::vector<int> comp_values;
-	for (int y = 0; y < height; y++) {
-		for (int x = 0; x < width; x++) {
-			int comp = d->find(y * width + x);
+/* ************************************************************************* */
+int GraphBasedImageSeg::GraphSegmentNext(const cv::Mat& depth_map, const int small_thresh, cv::Mat& labels,
+										 std::vector<RegionInfo>& region_info, cv::Mat& dst)
+{
+	if (CV_16UC1 != depth_map.type() || dof_table.empty())
+	{
+		return -1;
+	}
+
+	const int width = depth_map.cols;
+	const int height = depth_map.rows;
+	const int tile = dirty_tile_size;
+	TemporalSegmentation& state = temporal;
+	INSTRUMENT_SCOPE("segment_next");
 
-		   	std::vector<int>::iterator iter = find(comp_values.begin(), comp_values.end(), comp);
-			if(comp_values.end() == iter)
+	if (state.labels.empty() || state.reference_depth.size() != depth_map.size())
+	{
+		SegmentTemporalFull(depth_map, small_thresh);
+		state.num_dirty_tiles = -1;
+	}
+	else
+	{
+		// tiles with a changed pixel
+		const int tiles_x = (width + tile - 1) / tile;
+		const int tiles_y = (height + tile - 1) / tile;
+		std::vector<char>& changed = workspace.changed_tiles;
+		changed.assign(static_cast<size_t>(tiles_x) * tiles_y, 0);
+		ParallelFor(cv::Range(0, tiles_y), [&](const cv::Range& range)
+		{
+			for (int y = range.start * tile; y < std::min(range.end * tile, height); y++)
 			{
-				comp_values.push_back(comp);
+				const ushort* ptr_depth_map = depth_map.ptr<ushort>(y);
+				const ushort* ptr_reference = state.reference_depth.ptr<ushort>(y);
+				char* ptr_changed = &changed[(y / tile) * tiles_x];
+				for (int x = 0; x < width; x++)
+				{
+					if (std::abs(ptr_depth_map[x] - ptr_reference[x]) > change_thresh)
+					{
+						ptr_changed[x / tile] = 1;
+					}
+				}
 			}
+		});
 
-			comp_matrix.at<int>(y, x) = comp;
-			// assign color
-			for (int k = 0; k < 3; k++) {
-				dst.at<cv::Vec3b>(y, x)[k] = randClr[comp][k];
+		// their neighbours are segmented again as well, so regions can reshape across tile borders
+		std::vector<char>& dirty = workspace.dirty_tiles;
+		dirty.assign(changed.size(), 0);
+		int num_dirty = 0;
+		for (int ty = 0; ty < tiles_y; ty++) {
+			for (int tx = 0; tx < tiles_x; tx++) {
+				for (int ny = std::max(0, ty - 1); ny <= std::min(tiles_y - 1, ty + 1) && !dirty[ty * tiles_x + tx]; ny++) {
+					for (int nx = std::max(0, tx - 1); nx <= std::min(tiles_x - 1, tx + 1); nx++) {
+						if (changed[ny * tiles_x + nx]) {
+							dirty[ty * tiles_x + tx] = 1;
+							break;
+						}
+					}
+				}
+				num_dirty += dirty[ty * tiles_x + tx];
+			}
+		}
+
+		// stitching pays off only while most of the frame stays
+		if (2 * num_dirty > tiles_x * tiles_y)
+		{
+			SegmentTemporalFull(depth_map, small_thresh);
+			state.num_dirty_tiles = -1;
+		}
+		else
+		{
+			if (num_dirty > 0)
+			{
+				SegmentTemporalTiles(depth_map, small_thresh, dirty, tiles_x);
+			}
+			state.num_dirty_tiles = num_dirty;
+		}
+	}
+
+	// mirror the labels like GraphSegment, ids without pixels keep an empty entry
+	const int num_labels = static_cast<int>(state.region_size.size());
+	INSTRUMENT_COUNT(COUNTER_REGIONS, num_labels);
+	RegionInfo empty_info;
+	empty_info.pixel_count = 0;
+	empty_info.bounding_box = cv::Rect();
+	region_info.assign(num_labels, empty_info);
+	labels.create(height, width, CV_32SC1);
+	dst.create(height, width, CV_8UC3);
+	for (int y = 0; y < height; y++) {
+		const int* ptr_state = &state.labels[y * width];
+		int* ptr_labels = labels.ptr<int>(y);
+		cv::Vec3b* ptr_dst = dst.ptr<cv::Vec3b>(y);
+		for (int x = 0; x < width; x++) {
+			const int label = ptr_state[x];
+			const int flipped_x = width - 1 - x;
+			ptr_labels[flipped_x] = label;
+
+			RegionInfo& info = region_info[label];
+			cv::Rect& box = info.bounding_box;
+			if (0 == info.pixel_count++) {
+				box = cv::Rect(flipped_x, y, 1, 1);
+			}
+			else if (flipped_x < box.x) {
+				box.width += box.x - flipped_x;
+				box.x = flipped_x;
 			}
+			else if (flipped_x >= box.x + box.width) {
+				box.width = flipped_x - box.x + 1;
+			}
+			box.height = y - box.y + 1;
+
+			ptr_dst[x] = LabelColor(label);
 		}
 	}
 
-	regions.resize(comp_values.size());
-	for(int idx = 0; idx < comp_values.size(); ++idx)
+	return num_labels;
+}
+
+/* ************************************************************************* */
+int LabelsToRegions(const cv::Mat& labels, const int num_regions, std::vector<cv::Mat>& regions)
+{
+	if (CV_32SC1 != labels.type() || num_regions < 0)
+	{
+		return 1;
+	}
+
+	regions.resize(num_regions);
+	for (int idx = 0; idx < num_regions; ++idx)
 	{
-		regions[idx] = (comp_matrix == comp_values[idx]);
-		cv::flip(regions[idx], regions[idx], 1);
-		//cv::imshow("region", regions[idx]);
-		//cv::waitKey(0);
+		regions[idx] = cv::Mat::zeros(labels.size(), CV_8UC1);
 	}
 
-	delete d;
+	for (int y = 0; y < labels.rows; y++)
+	{
+		const int* ptr_labels = labels.ptr<int>(y);
+		for (int x = 0; x < labels.cols; x++)
+		{
+			const int label = ptr_labels[x];
+			if (label >= 0 && label < num_regions)
+			{
+				regions[label].ptr<uchar>(y)[x] = 255;
+			}
+		}
+	}
 
-	return d->num_sets();
+	return 0;
 }
 
 /* ************************************************************************* */
-bool Comparison(const Edge& a, const Edge& b)
+int GetRegionMask(const cv::Mat& labels, const int label, cv::Mat& mask)
 {
-	return a.w < b.w;		
+	if (CV_32SC1 != labels.type())
+	{
+		return 1;
+	}
+
+	mask = (labels == label);
+
+	return 0;
 }
 
 /* ************************************************************************* */
-DisJoint *GraphBasedImageSeg::SegGraph(const cv::Mat& depth_map, const int num_vertices, 
-					   const int num_edges, Edge* edges)
+template <typename PixelT, typename WeightT>
+UnionFind *GraphBasedImageSeg::SegGraph(const cv::Mat& depth_map, const int num_vertices, 
+					   EdgeGraph<WeightT>& graph)
 {
-	int height = depth_map.rows;
-	int width = depth_map.cols;
-
-	std::sort(edges, edges + num_edges, Comparison);
+	{
+		INSTRUMENT_SCOPE("edge_sort");
+		graph.SortByWeight();
+	}
+	INSTRUMENT_SCOPE("union_find");
 
-	DisJoint *d = new DisJoint(num_vertices);
+	UnionFind *d = &workspace.forest;
+	d->Reset(num_vertices);
 
 	// stores the maximum and minimum depth value of each region
-	double* component_max = new double[num_vertices];
-	double* component_min = new double[num_vertices];
+	PixelT* component_max = ComponentBounds<PixelT>(workspace.component_max, num_vertices);
+	PixelT* component_min = ComponentBounds<PixelT>(workspace.component_min, num_vertices);
+	InitComponentBounds(depth_map, component_min, component_max);
 
-	for (int i = 0; i < num_vertices; i++) 
+	const int num_edges = graph.num_edges();
+	int merges = 0;
+	for (int i = 0; i < num_edges; i++) 
 	{
-		int row = i / width;
-		int col = i % width;
+		int a = d->find(graph.source(i));
+		int b = d->find(graph.target(i));
+
+		if ((a != b) && MergeWithinDof(d, a, b, component_min, component_max))
+		{
+			merges++;
+		}
+	}
+	d->num -= merges;
+
+	return d;
+}
 
-		const double* ptr_depth_map = depth_map.ptr<double>(row);
-		double depth_value = ptr_depth_map[col];
+/* ************************************************************************* */
+template <typename PixelT, typename WeightT>
+UnionFind *GraphBasedImageSeg::SegGraphTiled(const cv::Mat& depth_map, const int num_vertices, 
+											 EdgeGraph<WeightT>& graph)
+{
+	const int width = depth_map.cols;
+	const int tiles_x = (width + tile_size - 1) / tile_size;
+	const int tiles_y = (depth_map.rows + tile_size - 1) / tile_size;
+	const int num_tiles = tiles_x * tiles_y;
+	// edges crossing a tile border go to the last bucket
+	const int boundary_bucket = num_tiles;
+	const int num_buckets = num_tiles + 1;
 
-		component_max[i] = depth_value;
-		component_min[i] = depth_value;
+	{
+		INSTRUMENT_SCOPE("edge_sort");
+		graph.SortByWeight();
 	}
+	const int num_edges = graph.num_edges();
 
-	for (int i = 0; i < num_edges; i++) 
+	// stable bucketing of the sorted edges by tile keeps every bucket sorted
+	const int num_chunks = std::max(1, std::min(GetParallelThreads(), num_edges / 65536));
+	std::vector<int>& edge_bucket = workspace.edge_bucket;
+	std::vector<int>& histograms = workspace.bucket_histograms;
+	edge_bucket.resize(num_edges);
+	histograms.assign(static_cast<size_t>(num_chunks) * num_buckets, 0);
+	ParallelFor(cv::Range(0, num_chunks), [&](const cv::Range& range)
 	{
-		Edge* pedge = &edges[i];
-		//const Edge* pedge = edges + i;
+		for (int chunk = range.start; chunk < range.end; chunk++)
+		{
+			const int begin = static_cast<int>(static_cast<int64>(num_edges) * chunk / num_chunks);
+			const int end = static_cast<int>(static_cast<int64>(num_edges) * (chunk + 1) / num_chunks);
+			int* histogram = &histograms[static_cast<size_t>(chunk) * num_buckets];
+			for (int i = begin; i < end; i++)
+			{
+				const int a = graph.source(i);
+				const int b = graph.target(i);
+				const int tile_a = (a / width / tile_size) * tiles_x + (a % width) / tile_size;
+				const int tile_b = (b / width / tile_size) * tiles_x + (b % width) / tile_size;
+				edge_bucket[i] = (tile_a == tile_b) ? tile_a : boundary_bucket;
+				histogram[edge_bucket[i]]++;
+			}
+		}
+	});
 
-		int a = d->find(pedge->a);
-		int b = d->find(pedge->b);
+	std::vector<int>& bucket_offsets = workspace.bucket_offsets;
+	bucket_offsets.assign(num_buckets + 1, 0);
+	int total = 0;
+	for (int bucket = 0; bucket < num_buckets; bucket++)
+	{
+		bucket_offsets[bucket] = total;
+		for (int chunk = 0; chunk < num_chunks; chunk++)
+		{
+			int& count = histograms[static_cast<size_t>(chunk) * num_buckets + bucket];
+			const int slot = total;
+			total += count;
+			count = slot;
+		}
+	}
+	bucket_offsets[num_buckets] = total;
 
-		if (a != b) 
+	std::vector<int>& bucketed_edges = workspace.bucketed_edges;
+	bucketed_edges.resize(num_edges);
+	ParallelFor(cv::Range(0, num_chunks), [&](const cv::Range& range)
+	{
+		for (int chunk = range.start; chunk < range.end; chunk++)
 		{
-			// Depth of field constraint
-			double a_min = component_min[a];
-			double a_max = component_max[a];
-			double b_min = component_min[b];
-			double b_max = component_max[b];
+			const int begin = static_cast<int>(static_cast<int64>(num_edges) * chunk / num_chunks);
+			const int end = static_cast<int>(static_cast<int64>(num_edges) * (chunk + 1) / num_chunks);
+			int* slots = &histograms[static_cast<size_t>(chunk) * num_buckets];
+			for (int i = begin; i < end; i++)
+			{
+				bucketed_edges[slots[edge_bucket[i]]++] = i;
+			}
+		}
+	});
 
-			double minimum = std::min(a_min, b_min);
-			double maximum = std::max(a_max, b_max);
+	UnionFind *d = &workspace.forest;
+	d->Reset(num_vertices);
 
-			double diff = (maximum - minimum);	//mm
-			FrontBackDOF dof_at_minimum = GetFrontBackDof(minimum);
-			FrontBackDOF dof_at_maximum = GetFrontBackDof(maximum);
+	// stores the maximum and minimum depth value of each region
+	PixelT* component_max = ComponentBounds<PixelT>(workspace.component_max, num_vertices);
+	PixelT* component_min = ComponentBounds<PixelT>(workspace.component_min, num_vertices);
+	InitComponentBounds(depth_map, component_min, component_max);
 
-			if ((diff < dof_at_minimum.back_dof) || (diff < dof_at_maximum.front_dof))
+	// tiles are segmented independently, their components never leave the tile so
+	// the threads touch disjoint parts of the forest
+	std::vector<int>& tile_merges = workspace.tile_merges;
+	tile_merges.assign(num_tiles, 0);
+	ParallelFor(cv::Range(0, num_tiles), [&](const cv::Range& range)
+	{
+		INSTRUMENT_SCOPE("tile_union_find");
+		for (int tile = range.start; tile < range.end; tile++)
+		{
+			int merges = 0;
+			for (int k = bucket_offsets[tile]; k < bucket_offsets[tile + 1]; k++)
 			{
-				d->join(a, b);
-				a = d->find(a);
+				const int i = bucketed_edges[k];
+				int a = d->find(graph.source(i));
+				int b = d->find(graph.target(i));
+				if ((a != b) && MergeWithinDof(d, a, b, component_min, component_max))
+				{
+					merges++;
+				}
+			}
+			tile_merges[tile] = merges;
+		}
+	});
+	for (int tile = 0; tile < num_tiles; tile++)
+	{
+		d->num -= tile_merges[tile];
+	}
 
-				// Update min and max array
-				component_min[a] = minimum;
-				component_max[a] = maximum;
+	// stitch the tiles with the same criterion, processing the border edges in weight order
+	INSTRUMENT_SCOPE("stitch");
+	const int* boundary_edges = &bucketed_edges[0] + bucket_offsets[boundary_bucket];
+	const int num_boundary_edges = bucket_offsets[boundary_bucket + 1] - bucket_offsets[boundary_bucket];
+	if (concurrent_merge)
+	{
+		MergeBoundariesConcurrent(d, depth_map, graph, boundary_edges, num_boundary_edges, component_min, component_max);
+	}
+	else
+	{
+		int merges = 0;
+		for (int k = 0; k < num_boundary_edges; k++)
+		{
+			const int i = boundary_edges[k];
+			int a = d->find(graph.source(i));
+			int b = d->find(graph.target(i));
+			if ((a != b) && MergeWithinDof(d, a, b, component_min, component_max))
+			{
+				merges++;
 			}
 		}
+		d->num -= merges;
+	}
+
+	return d;
+}
+
+/* ************************************************************************* */
+template <typename PixelT, typename WeightT>
+void GraphBasedImageSeg::MergeBoundariesConcurrent(UnionFind* d, const cv::Mat& depth_map,
+												   const EdgeGraph<WeightT>& graph,
+												   const int* boundary_edges, const int num_boundary_edges,
+												   PixelT* component_min, PixelT* component_max)
+{
+	const int num_vertices = static_cast<int>(d->parent.size());
+	const int width = depth_map.cols;
+
+	ConcurrentUnionFind& sets = workspace.concurrent_forest;
+	sets.Reset(num_vertices);
+	sets.Assign(*d);
 
+	if (!workspace.merge_locks)
+	{
+		workspace.merge_locks.reset(new std::mutex[MERGE_LOCK_STRIPES]);
 	}
+	std::mutex* locks = workspace.merge_locks.get();
 
-	delete[] component_min;
-	delete[] component_max;
+	// the bounds of a root are only touched with its stripe locked, and two roots are only
+	// linked with both stripes locked. A merge therefore sees the bounds of every merge
+	// before it, and the merged component satisfies the criterion just as in the serial stitch
+	auto merge = [&](const int k)
+	{
+		const int i = boundary_edges[k];
+		const int u = graph.source(i);
+		const int v = graph.target(i);
+		for (;;)
+		{
+			const int a = sets.find(u);
+			const int b = sets.find(v);
+			if (a == b) return;
 
-	return d;
+			const int stripe_a = a & (MERGE_LOCK_STRIPES - 1);
+			const int stripe_b = b & (MERGE_LOCK_STRIPES - 1);
+			std::unique_lock<std::mutex> first_lock(locks[std::min(stripe_a, stripe_b)]);
+			std::unique_lock<std::mutex> second_lock;
+			if (stripe_a != stripe_b)
+			{
+				second_lock = std::unique_lock<std::mutex>(locks[std::max(stripe_a, stripe_b)]);
+			}
+			if (!sets.is_root(a) || !sets.is_root(b))
+			{
+				// another thread merged one of them in the meantime, look the roots up again
+				continue;
+			}
+
+			const PixelT minimum = std::min(component_min[a], component_min[b]);
+			const PixelT maximum = std::max(component_max[a], component_max[b]);
+			if (!WithinDof(minimum, maximum)) return;
+
+			const int root = std::min(a, b);
+			sets.link_root(std::max(a, b), root);
+			component_min[root] = minimum;
+			component_max[root] = maximum;
+			return;
+		}
+	};
+
+	// weight of a border edge, as EdgeGraph computes it
+	auto weight = [&](const int k)
+	{
+		const int i = boundary_edges[k];
+		const int u = graph.source(i);
+		const int v = graph.target(i);
+		const PixelT a = depth_map.ptr<PixelT>(u / width)[u % width];
+		const PixelT b = depth_map.ptr<PixelT>(v / width)[v % width];
+		return static_cast<double>(a > b ? a - b : b - a);
+	};
+
+	// the edges of one weight run concurrently, but all of them before any heavier edge
+	for (int begin = 0; begin < num_boundary_edges; )
+	{
+		const double run_weight = weight(begin);
+		int end = begin + 1;
+		while (end < num_boundary_edges && weight(end) == run_weight)
+		{
+			end++;
+		}
+
+		if (end - begin < CONCURRENT_MERGE_MIN_EDGES)
+		{
+			for (int k = begin; k < end; k++)
+			{
+				merge(k);
+			}
+		}
+		else
+		{
+			ParallelFor(cv::Range(begin, end), [&](const cv::Range& range)
+			{
+				for (int k = range.start; k < range.end; k++)
+				{
+					merge(k);
+				}
+			}, GetParallelThreads() * 4);
+		}
+		begin = end;
+	}
+
+	sets.Export(*d);
 }
 
 
@@ -1,71 +1,578 @@
 #include "select_combine.h"
 
+#include <algorithm>
+#include <climits>
 #include <iostream>
 
 #include "opencv2/imgproc/imgproc.hpp"
-#include "opencv2/highgui.hpp"
+#include "opencv2/videoio.hpp"
+
+#include "diagnostics.h"
+#include "frame_pool.h"
+#include "fusion_engine.h"
+#include "instrument.h"
 
 int ConstructAllInFocusImage(const std::vector<cv::Mat>& segmented_regions,  
                              const std::string video_file_name, 
                              cv::Mat& all_in_focus_img)
 {
-    const int region_size = segmented_regions.size();
+    if (segmented_regions.empty())
+    {
+        return -1;
+    }
+
+    // later masks win where masks overlap
+    cv::Mat labels(segmented_regions[0].size(), CV_32SC1, cv::Scalar(-1));
+    for (int i = 0; i < static_cast<int>(segmented_regions.size()); ++i)
+    {
+        labels.setTo(i, segmented_regions[i]);
+    }
+
+    return ConstructAllInFocusImage(labels, segmented_regions.size(), video_file_name, all_in_focus_img);
+}
+
+FusionOptions GetDefaultFusionOptions(void)
+{
+    FusionOptions options;
+    options.compose_mode = FUSION_COMPOSE_CACHE;
+    options.cache_frames = 4;
+    options.num_workers = 0;
+    options.focus_measure = FOCUS_NORMALIZED_VARIANCE;
+    options.coarse_level = 0;
+    options.top_k = 3;
+    options.retire_hysteresis = 0.0f;
+    options.retire_frames = 2;
+
+    return options;
+}
+
+int ConstructAllInFocusImage(const cv::Mat& labels, const int num_regions,
+                             const std::string video_file_name, 
+                             cv::Mat& all_in_focus_img)
+{
+    std::vector<int> best_frames;
+
+    return ConstructAllInFocusImage(labels, num_regions, video_file_name, GetDefaultFusionOptions(),
+                                    all_in_focus_img, best_frames);
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       compose the all-in-focus image from cached winner frames
+* @param  labels:               region id of every pixel
+* @param  best_frames:          best frame of every region
+* @param  cached_frames:        frame index held by every cache buffer, -1 if unused
+* @param  cache_pool:           cache buffers
+* @param  all_in_focus_img:		constructed all in focus image
+*/
+static void ComposeFromCache(const cv::Mat& labels, const std::vector<int>& best_frames,
+                             const std::vector<int>& cached_frames, FramePool& cache_pool,
+                             cv::Mat& all_in_focus_img)
+{
+    const int num_regions = static_cast<int>(best_frames.size());
+
+    // frame of every region, empty for regions without a winner
+    std::vector<cv::Mat> region_frames(num_regions);
+    for (int i = 0; i < num_regions; ++i)
+    {
+        for (int slot = 0; slot < static_cast<int>(cached_frames.size()); ++slot)
+        {
+            if (best_frames[i] >= 0 && cached_frames[slot] == best_frames[i])
+            {
+                region_frames[i] = cache_pool.Get(slot);
+            }
+        }
+    }
+
+    all_in_focus_img.create(labels.size(), CV_8UC3);
+    for (int y = 0; y < labels.rows; ++y)
+    {
+        const int* ptr_labels = labels.ptr<int>(y);
+        cv::Vec3b* ptr_all_in_focus = all_in_focus_img.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < labels.cols; ++x)
+        {
+            const int label = ptr_labels[x];
+            if (label >= 0 && label < num_regions && !region_frames[label].empty())
+            {
+                ptr_all_in_focus[x] = region_frames[label].ptr<cv::Vec3b>(y)[x];
+            }
+            else
+            {
+                ptr_all_in_focus[x] = cv::Vec3b(0, 0, 0);
+            }
+        }
+    }
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       compose the all-in-focus image by decoding the video again, only
+*                               one frame is held at a time
+* @param  labels:               region id of every pixel
+* @param  best_frames:          best frame of every region
+* @param  video_file_name:		name of multi-focus video
+* @param  all_in_focus_img:		constructed all in focus image
+* @return:                      0, success; -1 failure
+*/
+static int ComposeByRedecode(const cv::Mat& labels, const std::vector<int>& best_frames,
+                             const std::string video_file_name, cv::Mat& all_in_focus_img)
+{
+    const int num_regions = static_cast<int>(best_frames.size());
+
+    all_in_focus_img = cv::Mat::zeros(labels.size(), CV_8UC3);
+
+    int last_frame = -1;
+    for (int i = 0; i < num_regions; ++i)
+    {
+        last_frame = std::max(last_frame, best_frames[i]);
+    }
+    if (last_frame < 0)
+    {
+        return 0;
+    }
 
-    std::cout << "region_size: " << region_size << std::endl;
+    // bucket the pixels by the frame they are taken from
+    std::vector<int> frame_offsets(last_frame + 2, 0);
+    for (int y = 0; y < labels.rows; ++y)
+    {
+        const int* ptr_labels = labels.ptr<int>(y);
+        for (int x = 0; x < labels.cols; ++x)
+        {
+            const int label = ptr_labels[x];
+            if (label >= 0 && label < num_regions && best_frames[label] >= 0)
+            {
+                frame_offsets[best_frames[label] + 1]++;
+            }
+        }
+    }
+    for (int k = 0; k <= last_frame; ++k)
+    {
+        frame_offsets[k + 1] += frame_offsets[k];
+    }
+    std::vector<int> frame_pixels(frame_offsets[last_frame + 1]);
+    std::vector<int> slots(frame_offsets.begin(), frame_offsets.end() - 1);
+    for (int y = 0; y < labels.rows; ++y)
+    {
+        const int* ptr_labels = labels.ptr<int>(y);
+        for (int x = 0; x < labels.cols; ++x)
+        {
+            const int label = ptr_labels[x];
+            if (label >= 0 && label < num_regions && best_frames[label] >= 0)
+            {
+                frame_pixels[slots[best_frames[label]]++] = y * labels.cols + x;
+            }
+        }
+    }
 
     cv::VideoCapture multi_focus_video(video_file_name);
     if(!multi_focus_video.isOpened())
     {
         std::cout << "Can not open " << video_file_name << std::endl;
+        return -1;
     }
 
-    cv::Mat multi_focus_img, multi_focus_gray_img;
-    cv::Mat img_for_calc_nv;
-    std::vector<float> max_nv_vector(region_size, 0.0f); 
-    std::vector<cv::Mat> clearest_img_vector(region_size);
-    
-    for (;;) 
-	{
-		multi_focus_video >> multi_focus_img;
-		if (multi_focus_img.empty()) 
-            break;
+    cv::Mat multi_focus_img;
+    for (int k = 0; k <= last_frame; ++k)
+    {
+        {
+            INSTRUMENT_SCOPE("decode");
+            multi_focus_video >> multi_focus_img;
+        }
+        INSTRUMENT_COUNT(COUNTER_FRAMES_DECODED, 1);
+        if (multi_focus_img.empty() || multi_focus_img.size() != labels.size())
+        {
+            std::cout << "Can not decode frame " << k << " of " << video_file_name << std::endl;
+            return -1;
+        }
+
+        for (int p = frame_offsets[k]; p < frame_offsets[k + 1]; ++p)
+        {
+            const int y = frame_pixels[p] / labels.cols;
+            const int x = frame_pixels[p] % labels.cols;
+            all_in_focus_img.ptr<cv::Vec3b>(y)[x] = multi_focus_img.ptr<cv::Vec3b>(y)[x];
+        }
+    }
+
+    return 0;
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       check whether a frame is inside the depth guided window of a region
+* @param  options:              fusion options
+* @param  region:               region id
+* @param  frame_idx:            frame index
+* @return:                      true if the region is evaluated on this frame
+*/
+static bool InFrameWindow(const FusionOptions& options, const int region, const int frame_idx)
+{
+    return options.frame_window_first.empty() ||
+           (options.frame_window_first[region] <= frame_idx && frame_idx <= options.frame_window_last[region]);
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       get the last frame any region needs under the depth guided search
+* @param  options:              fusion options
+* @param  num_regions:          number of regions
+* @return:                      frame index, INT_MAX if the whole video is needed
+*/
+static int LastGuidedFrame(const FusionOptions& options, const int num_regions)
+{
+    if (static_cast<int>(options.frame_window_last.size()) != num_regions ||
+        static_cast<int>(options.frame_window_first.size()) != num_regions)
+    {
+        return INT_MAX;
+    }
+
+    int last = -1;
+    for (int i = 0; i < num_regions; ++i)
+    {
+        last = std::max(last, options.frame_window_last[i]);
+    }
+
+    return last;
+}
+
+/* ************************************************************************* */
+/**
+* @brief Follows the focus curve of every region during a scan in frame order. A focus
+*        sweep gives a roughly unimodal curve, so a region whose score stays clearly below
+*        its peak for a few frames will not get sharper and is retired
+*/
+class FocusPeakTracker{
+public:
+    FocusPeakTracker(const int num_regions, const FusionOptions& options, const bool enable)
+        : hysteresis(options.retire_hysteresis), patience(std::max(1, options.retire_frames)),
+          frames_below(num_regions, 0), retired(num_regions, 0), retired_count(0)
+    {
+        active = enable && hysteresis > 0.0f;
+    }
+
+    /* ************************************************************************* */
+    /**
+    * @brief:                   check whether a region is retired
+    * @param  region:           region id
+    * @return:                  true if retired
+    */
+    bool is_retired(const int region) const { return 0 != retired[region]; }
 
-		cv::cvtColor(multi_focus_img, multi_focus_gray_img, cv::COLOR_BGR2GRAY);
+    /* ************************************************************************* */
+    /**
+    * @brief:                   check whether every region is retired
+    * @return:                  true if the scan can stop
+    */
+    bool all_retired() const { return active && retired_count == static_cast<int>(retired.size()); }
 
-		for (int i = 0; i < region_size; ++i)
+    /* ************************************************************************* */
+    /**
+    * @brief:                   feed the score of the next evaluated frame of a region
+    * @param  region:           region id
+    * @param  score:            score of the frame
+    * @param  peak:             best score so far, including this frame
+    * @return:                  true if the region retires now
+    */
+    bool Update(const int region, const float score, const float peak)
+    {
+        if (!active || retired[region])
+        {
+            return false;
+        }
+
+        if (peak > 0.0f && score < peak * (1.0f - hysteresis))
+        {
+            if (++frames_below[region] >= patience)
+            {
+                retired[region] = 1;
+                ++retired_count;
+                return true;
+            }
+        }
+        else
+        {
+            frames_below[region] = 0;
+        }
+
+        return false;
+    }
+
+private:
+    bool active;
+    float hysteresis;
+    int patience;
+    std::vector<int> frames_below;
+    std::vector<char> retired;
+    int retired_count;
+};
+
+/* ************************************************************************* */
+/**
+* @brief:                       score every frame on a pyramid level and keep the sharpest
+*                               options.top_k frames of every region
+* @param  labels:               region id of every pixel
+* @param  num_regions:          number of regions
+* @param  video_file_name:		name of multi-focus video
+* @param  options:              fusion options
+* @param  candidates:           candidate frames of every region, sharpest first, at
+*                               region * top_k + rank; -1 for unused ranks
+* @param  selected_frames:      non-zero for every frame that is a candidate of some region
+* @return:                      0, success; -1 failure
+*/
+static int FindCandidateFrames(const cv::Mat& labels, const int num_regions,
+                               const std::string video_file_name, const FusionOptions& options,
+                               std::vector<int>& candidates, std::vector<char>& selected_frames)
+{
+    INSTRUMENT_SCOPE("coarse_candidates");
+    const int top_k = options.top_k;
+    candidates.assign(num_regions * top_k, -1);
+    std::vector<float> scores(num_regions * top_k, 0.0f);
+    FocusPeakTracker tracker(num_regions, options, true);
+
+    const int last_guided = LastGuidedFrame(options, num_regions);
+
+    FusionEngine engine(options.num_workers);
+    engine.SetFocusMeasure(options.focus_measure);
+    engine.SetPyramidLevel(options.coarse_level);
+    engine.SetRegionFrameWindows(options.frame_window_first, options.frame_window_last);
+    int num_frames = engine.Run(video_file_name, labels, num_regions,
+        [&](const int frame_idx, const cv::Mat& multi_focus_img, const std::vector<RegionStatistics>& stats)
+    {
+        (void)multi_focus_img;
+        for (int i = 0; !stats.empty() && i < num_regions; ++i)
+        {
+            if (tracker.is_retired(i) || !InFrameWindow(options, i, frame_idx))
+            {
+                continue;
+            }
+
+            // like the full resolution scan only positive scores count, earlier frames win ties
+            const float score = FocusScore(options.focus_measure, stats[i]);
+            if (tracker.Update(i, score, std::max(score, scores[i * top_k])))
+            {
+                engine.RetireRegion(i);
+            }
+            if (!(score > 0.0f))
+            {
+                continue;
+            }
+
+            int* region_candidates = &candidates[i * top_k];
+            float* region_scores = &scores[i * top_k];
+            int rank = top_k;
+            while (rank > 0 && (region_candidates[rank - 1] < 0 || score > region_scores[rank - 1]))
+            {
+                --rank;
+            }
+            if (rank == top_k)
+            {
+                continue;
+            }
+            for (int r = top_k - 1; r > rank; --r)
+            {
+                region_candidates[r] = region_candidates[r - 1];
+                region_scores[r] = region_scores[r - 1];
+            }
+            region_candidates[rank] = frame_idx;
+            region_scores[rank] = score;
+        }
+
+        return (tracker.all_retired() || frame_idx >= last_guided) ? 1 : 0;
+    });
+    if (num_frames < 0)
+    {
+        return -1;
+    }
+
+    selected_frames.assign(std::max(num_frames, 1), 0);
+    for (int i = 0; i < static_cast<int>(candidates.size()); ++i)
+    {
+        if (candidates[i] >= 0)
+        {
+            selected_frames[candidates[i]] = 1;
+        }
+    }
+
+    return 0;
+}
+
+int ConstructAllInFocusImage(const cv::Mat& labels, const int num_regions,
+                             const std::string video_file_name, const FusionOptions& options,
+                             cv::Mat& all_in_focus_img, std::vector<int>& best_frames)
+{
+    if (CV_32SC1 != labels.type() || num_regions <= 0)
+    {
+        return -1;
+    }
+    if (!options.frame_window_first.empty() &&
+        (static_cast<int>(options.frame_window_first.size()) != num_regions ||
+         static_cast<int>(options.frame_window_last.size()) != num_regions))
+    {
+        return -1;
+    }
+    INSTRUMENT_SCOPE("fuse");
+
+    if (DiagEnabled(DIAG_DEBUG))
+    {
+        std::cout << "region_size: " << num_regions << std::endl;
+    }
+
+    std::vector<float> max_nv_vector(num_regions, 0.0f); 
+    best_frames.assign(num_regions, -1);
+
+    // pooled copies of the frames that are currently the best of some region, with the
+    // number of regions using each of them
+    bool use_cache = (FUSION_COMPOSE_CACHE == options.compose_mode);
+    const int cache_frames = std::max(0, options.cache_frames);
+    FramePool cache_pool;
+    std::vector<int> cached_frames(cache_frames, -1);
+    std::vector<int> cached_users(cache_frames, 0);
+
+    // coarse to fine: only the candidates found on the pyramid level are scored at full
+    // resolution, and the scan stops after the last of them
+    const bool coarse_to_fine = (options.coarse_level > 0 && options.top_k > 0);
+    const int top_k = options.top_k;
+    std::vector<int> candidates;
+    std::vector<char> selected_frames;
+    int last_selected = -1;
+    if (coarse_to_fine)
+    {
+        if (0 != FindCandidateFrames(labels, num_regions, video_file_name, options, candidates, selected_frames))
+        {
+            return -1;
+        }
+        for (int k = 0; k < static_cast<int>(selected_frames.size()); ++k)
+        {
+            if (selected_frames[k])
+            {
+                last_selected = k;
+            }
+        }
+    }
+
+    // the full resolution scan retires regions unless it only visits candidates
+    FocusPeakTracker tracker(num_regions, options, !coarse_to_fine);
+
+    // the depth guided search needs nothing after the end of the last window
+    const int last_guided = LastGuidedFrame(options, num_regions);
+    last_selected = coarse_to_fine ? std::min(last_selected, last_guided) : last_guided;
+
+    // frames arrive in order, so the reduction is the same as a sequential scan
+    FusionEngine engine(options.num_workers);
+    engine.SetFocusMeasure(options.focus_measure);
+    engine.SetFrameSelection(selected_frames);
+    engine.SetRegionFrameWindows(options.frame_window_first, options.frame_window_last);
+    int num_frames = engine.Run(video_file_name, labels, num_regions,
+        [&](const int frame_idx, const cv::Mat& multi_focus_img, const std::vector<RegionStatistics>& stats)
+    {
+        if (use_cache && 0 == frame_idx)
+        {
+            cache_pool.Reserve(multi_focus_img.size(), multi_focus_img.type(), cache_frames);
+        }
+        if (stats.empty())
+        {
+            return (frame_idx >= last_selected) ? 1 : 0;
+        }
+
+        int improved_regions = 0;
+		for (int i = 0; i < num_regions; ++i)
 		{
-			multi_focus_gray_img.copyTo(img_for_calc_nv, segmented_regions[i]);
+            if (coarse_to_fine && 
+                std::find(&candidates[i * top_k], &candidates[i * top_k] + top_k, frame_idx) == &candidates[i * top_k] + top_k)
+            {
+                continue;
+            }
+            if (tracker.is_retired(i) || !InFrameWindow(options, i, frame_idx))
+            {
+                continue;
+            }
 
-			float cur_normalized_variance = CalculateNormalizedVariance(img_for_calc_nv);
+			float cur_normalized_variance = FocusScore(options.focus_measure, stats[i]);
+            if (tracker.Update(i, cur_normalized_variance, std::max(cur_normalized_variance, max_nv_vector[i])))
+            {
+                engine.RetireRegion(i);
+            }
 
 			if (cur_normalized_variance > max_nv_vector[i])
 			{
 				max_nv_vector[i] = cur_normalized_variance;
-				//multi_focus_img.copyTo(all_in_focus_img, segmented_regions[i]);
-                multi_focus_img.copyTo(clearest_img_vector[i], segmented_regions[i]);
+
+                const int previous = best_frames[i];
+                for (int slot = 0; use_cache && previous >= 0 && slot < cache_frames; ++slot)
+                {
+                    if (previous == cached_frames[slot] && 0 == --cached_users[slot])
+                    {
+                        cached_frames[slot] = -1;
+                    }
+                }
+                best_frames[i] = frame_idx;
+                improved_regions++;
             }
+		}
 
-            img_for_calc_nv.setTo(0);
+        if (use_cache && improved_regions > 0)
+        {
+            int free_slot = -1;
+            for (int slot = 0; slot < cache_frames && free_slot < 0; ++slot)
+            {
+                if (cached_frames[slot] < 0)
+                {
+                    free_slot = slot;
+                }
+            }
 
-		}
-	}
+            if (free_slot >= 0)
+            {
+                cv::Mat cached_img = cache_pool.Get(free_slot);
+                multi_focus_img.copyTo(cached_img);
+                cache_pool.Track(cached_img, free_slot);
+                cached_frames[free_slot] = frame_idx;
+                cached_users[free_slot] = improved_regions;
+            }
+            else
+            {
+                // too many winners to hold, fall back to decoding them again
+                use_cache = false;
+            }
+        }
 
-    for(int i = 0; i < region_size; ++i)
+        return (frame_idx >= last_selected || tracker.all_retired()) ? 1 : 0;
+    });
+    if (num_frames < 0)
     {
-        clearest_img_vector[i].copyTo(all_in_focus_img, segmented_regions[i]);
-		cv::imshow("all_in_focus", all_in_focus_img);
-		cv::waitKey(0);
+        return -1;
     }
 
-    return 0;
+    INSTRUMENT_SCOPE("compose");
+    int ret = 0;
+    if (use_cache)
+    {
+        ComposeFromCache(labels, best_frames, cached_frames, cache_pool, all_in_focus_img);
+    }
+    else
+    {
+        ret = ComposeByRedecode(labels, best_frames, video_file_name, all_in_focus_img);
+    }
+    DiagShowImage(DIAG_DEBUG, "all_in_focus", all_in_focus_img, 0);
+
+    return ret;
+}
+
+int AccumulateRegionStatistics(const cv::Mat& gray_img, const cv::Mat& labels, const int num_regions,
+                               std::vector<RegionStatistics>& stats)
+{
+    return AccumulateFocusStatistics<NormalizedVarianceMeasure>(gray_img, labels, num_regions, stats);
 }
 
+float NormalizedVariance(const RegionStatistics& stats)
+{
+    return NormalizedVarianceMeasure::Score(stats);
+}
 
 float CalculateNormalizedVariance(const cv::Mat& region_img)
 {
 	// calculate total non-zero pixels and mean intensity in region_img
-	int total_pixels = 0;
-	int total_val = 0;
+	int64 total_pixels = 0;
+	int64 total_val = 0;
 	for (int i = 0; i < region_img.rows; ++i)
 	{
 		const uchar* ptr_region_img = region_img.ptr<uchar>(i);
@@ -0,0 +1,23 @@
+/**
+* @file union_find.cpp
+* @brief Disjoint set forest with a single dense int per element
+*/
+
+#include "union_find.h"
+
+/* ************************************************************************* */
+UnionFind::UnionFind(int elements) : parent(elements, -1), num(elements)
+{
+}
+
+/* ************************************************************************* */
+UnionFind::~UnionFind()
+{
+}
+
+/* ************************************************************************* */
+void UnionFind::Reset(int elements)
+{
+	parent.assign(elements, -1);
+	num = elements;
+}
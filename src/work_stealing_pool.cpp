@@ -0,0 +1,261 @@
+/**
+* @file work_stealing_pool.cpp
+* @brief Thread pool with per-worker task deques shared by scene-level and intra-stage parallelism
+*/
+
+#include "work_stealing_pool.h"
+
+#include <algorithm>
+
+#include "opencv2/core/utility.hpp"
+
+// pool and worker index of the calling thread
+static thread_local WorkStealingPool* current_pool = 0;
+static thread_local int current_worker = -1;
+
+/* ************************************************************************* */
+WorkStealingPool::WorkStealingPool(const int num_threads) : queued(0), unfinished(0), stopping(false)
+{
+	int workers = num_threads;
+	if (workers <= 0)
+	{
+		workers = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	}
+
+	for (int i = 0; i < workers; ++i)
+	{
+		queues.push_back(std::unique_ptr<TaskQueue>(new TaskQueue));
+	}
+	for (int i = 0; i < workers; ++i)
+	{
+		threads.push_back(std::thread(&WorkStealingPool::WorkerLoop, this, i));
+	}
+}
+
+/* ************************************************************************* */
+WorkStealingPool::~WorkStealingPool()
+{
+	Wait();
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i].join();
+	}
+}
+
+/* ************************************************************************* */
+WorkStealingPool* WorkStealingPool::current()
+{
+	return current_pool;
+}
+
+/* ************************************************************************* */
+void WorkStealingPool::Push(TaskQueue& queue, const Task& task, const bool back)
+{
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (back) queue.tasks.push_back(task);
+		else queue.tasks.push_front(task);
+	}
+	{
+		// the increment is ordered with the sleep check, so no wake-up gets lost
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		queued.fetch_add(1);
+	}
+	wake.notify_one();
+}
+
+/* ************************************************************************* */
+bool WorkStealingPool::Pop(TaskQueue& queue, Task& task, const bool back)
+{
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.tasks.empty())
+	{
+		return false;
+	}
+
+	if (back)
+	{
+		task.swap(queue.tasks.back());
+		queue.tasks.pop_back();
+	}
+	else
+	{
+		task.swap(queue.tasks.front());
+		queue.tasks.pop_front();
+	}
+	queued.fetch_sub(1);
+
+	return true;
+}
+
+/* ************************************************************************* */
+bool WorkStealingPool::FindTask(const int self, const bool include_injected, Task& task)
+{
+	// newest own task first, it is the most likely to be in cache
+	if (self >= 0 && Pop(*queues[self], task, true))
+	{
+		return true;
+	}
+
+	// steal the oldest task of another worker, the biggest remaining piece of its work
+	const int workers = num_threads();
+	for (int k = 1; k <= workers; ++k)
+	{
+		const int victim = (std::max(self, 0) + k) % workers;
+		if (victim != self && Pop(*queues[victim], task, false))
+		{
+			return true;
+		}
+	}
+
+	return include_injected && Pop(injected, task, false);
+}
+
+/* ************************************************************************* */
+void WorkStealingPool::WorkerLoop(const int self)
+{
+	current_pool = this;
+	current_worker = self;
+
+	Task task;
+	for (;;)
+	{
+		if (FindTask(self, true, task))
+		{
+			task();
+			task = Task();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+		if (stopping && 0 == queued.load())
+		{
+			break;
+		}
+	}
+
+	current_pool = 0;
+	current_worker = -1;
+}
+
+/* ************************************************************************* */
+void WorkStealingPool::Submit(const Task& task)
+{
+	unfinished.fetch_add(1);
+	Push(injected, [this, task]()
+	{
+		task();
+		if (1 == unfinished.fetch_sub(1))
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+			finished.notify_all();
+		}
+	}, true);
+}
+
+/* ************************************************************************* */
+void WorkStealingPool::Wait()
+{
+	std::unique_lock<std::mutex> lock(sleep_mutex);
+	finished.wait(lock, [this] { return 0 == unfinished.load(); });
+}
+
+/* ************************************************************************* */
+void WorkStealingPool::Spawn(const Task& task)
+{
+	const int self = (this == current_pool) ? current_worker : -1;
+	Push((self >= 0) ? *queues[self] : injected, task, true);
+}
+
+/* ************************************************************************* */
+bool WorkStealingPool::RunPendingTask()
+{
+	const int self = (this == current_pool) ? current_worker : -1;
+	Task task;
+	if (!FindTask(self, self < 0, task))
+	{
+		return false;
+	}
+	task();
+
+	return true;
+}
+
+/* ************************************************************************* */
+void WorkStealingPool::ParallelFor(const cv::Range& range, const LoopBody& body, const double nstripes)
+{
+	const int length = range.end - range.start;
+	if (length <= 0)
+	{
+		return;
+	}
+
+	int stripes = (nstripes > 0) ? static_cast<int>(nstripes) : num_threads() * 4;
+	stripes = std::max(1, std::min(stripes, length));
+	if (1 == stripes)
+	{
+		body(range);
+		return;
+	}
+
+	// the caller runs the first stripe, the others wait on its deque to be stolen. A caller
+	// from outside the pool hands them to the injection queue
+	const int self = (this == current_pool) ? current_worker : -1;
+	TaskQueue& queue = (self >= 0) ? *queues[self] : injected;
+	std::atomic<int> remaining(stripes - 1);
+	for (int s = stripes - 1; s > 0; --s)
+	{
+		const cv::Range stripe(range.start + static_cast<int>(static_cast<int64>(length) * s / stripes),
+							   range.start + static_cast<int>(static_cast<int64>(length) * (s + 1) / stripes));
+		Push(queue, [&body, &remaining, stripe]()
+		{
+			body(stripe);
+			remaining.fetch_sub(1, std::memory_order_release);
+		}, true);
+	}
+	body(cv::Range(range.start, range.start + static_cast<int>(length / stripes)));
+
+	// help with stripes while waiting, scenes from the injection queue are left alone so a
+	// stage never ends up waiting for an unrelated scene
+	Task task;
+	while (remaining.load(std::memory_order_acquire) > 0)
+	{
+		if (FindTask(self, self < 0, task))
+		{
+			task();
+			task = Task();
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+/* ************************************************************************* */
+void ParallelFor(const cv::Range& range, const WorkStealingPool::LoopBody& body, const double nstripes)
+{
+	WorkStealingPool* pool = WorkStealingPool::current();
+	if (pool)
+	{
+		pool->ParallelFor(range, body, nstripes);
+	}
+	else
+	{
+		cv::parallel_for_(range, body, nstripes);
+	}
+}
+
+/* ************************************************************************* */
+int GetParallelThreads(void)
+{
+	WorkStealingPool* pool = WorkStealingPool::current();
+
+	return pool ? pool->num_threads() : cv::getNumThreads();
+}
@@ -1,8 +1,10 @@
 #include "global.h"
 
 // System
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <string>
 
 // OpenCV
 #include "opencv2/core/core.hpp"
@@ -10,32 +12,204 @@
 #include "opencv2/highgui/highgui.hpp"
 
 #include "align_fill.h"
+#include "depth_io.h"
+#include "diagnostics.h"
+#include "focus_guide.h"
+#include "instrument.h"
+#include "scene_pipeline.h"
 #include "segment.h"
 #include "select_combine.h"
+#include "work_stealing_pool.h"
 
 //#define RUN_MY_MODIFIED_PROGRAM 1
 
-//usage: ./segment depth_data.xml multi_focus.avi
+//usage: ./segment depth.dpth|depth_data.xml multi_focus.avi [-v level] [--headless] [-t tile] [--concurrent-merge]
+//       ./segment --batch manifest.txt [-j threads] [options above except -d and -s]
+//                 [-f measure] [-p level] [-k top_k] [-r hysteresis]
+//                 [-d focus_distances.txt | -s near far frames] [--trace trace.json]
+//       depth.dpth: binary depth file (see depth_io.h, ./depth_convert turns XML into it), the
+//                   first frame is used
+//       manifest.txt: one scene per line, "depth video coc_diameter aperture_value focal_length
+//                     [output_prefix]" (see scene_pipeline.h); scenes run concurrently on
+//                     threads workers, 0 (default) for one per hardware thread
+//       level: 0 no debug output, 1 segmentation result, 2 every intermediate image
+//       tile: side length of the tiles segmented in parallel, 0 (default) for serial segmentation
+//       measure: 0 normalized variance (default), 1 Tenengrad, 2 variance of Laplacian,
+//                3 sum-modified-Laplacian
+//       level, top_k: score all frames on this pyramid level first and keep the top_k frames of
+//                     every region for the full resolution pass, 0 (default) scores everything
+//       hysteresis: stop evaluating a region once its focus dropped by this fraction below its
+//                   peak, e.g. 0.2; 0 (default) evaluates every frame
+//       focus_distances.txt: focus distance (mm) of every frame, one per line
+//       near, far, frames: the focus sweeps linearly from near to far (mm) over frames frames
+//                          every region is then only evaluated on the frames whose depth of field
+//                          reaches its depth range
+//       trace.json: stage timings and counters in the Chrome trace format, also summed up on
+//                   stdout; needs a build with -DENABLE_INSTRUMENTATION
+
+/* ************************************************************************* */
+/**
+* @brief:                       export the trace and print the stage summary
+* @param  trace_file:           Chrome trace file, nothing is reported if empty
+*/
+static void ReportInstrumentation(const std::string& trace_file)
+{
+	if (trace_file.empty())
+	{
+		return;
+	}
+	if (!IsInstrumentationEnabled())
+	{
+		std::cout << "Built without -DENABLE_INSTRUMENTATION, no trace is recorded" << std::endl;
+		return;
+	}
+
+	if (0 != ExportChromeTrace(trace_file))
+	{
+		std::cout << "Can not write " << trace_file << std::endl;
+	}
+	PrintInstrumentSummary(std::cout);
+}
+
+/* ************************************************************************* */
+/**
+* @brief:                       process the scenes of a manifest and report their timings
+* @param  manifest_file:        manifest
+* @param  num_threads:          pool threads, 0 for one per hardware thread
+* @param  tile_size:            tile-parallel segmentation, 0 for serial
+* @param  concurrent_merge:     stitch tiles concurrently
+* @param  fusion_options:       fusion options
+* @return:                      0 every scene succeeded; -1 otherwise
+*/
+static int RunBatch(const std::string& manifest_file, const int num_threads, const int tile_size,
+					const bool concurrent_merge, const FusionOptions& fusion_options)
+{
+	std::vector<SceneEntry> scenes;
+	if (0 != LoadSceneManifest(manifest_file, scenes))
+	{
+		std::cout << "Invalid manifest" << std::endl;
+		return -1;
+	}
+
+	SceneSettings settings = GetDefaultSceneSettings();
+	settings.fusion = fusion_options;
+	settings.tile_size = tile_size;
+	settings.concurrent_merge = concurrent_merge;
+
+	WorkStealingPool pool(num_threads);
+	std::vector<SceneResult> results;
+	const int64 start = cv::getTickCount();
+	const int failures = RunSceneBatch(scenes, settings, pool, results);
+	const double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+
+	for (size_t i = 0; i < scenes.size(); ++i)
+	{
+		const SceneResult& result = results[i];
+		printf("%s: %s, %d regions, load %.1f ms, align %.1f ms, segment %.1f ms, fuse %.1f ms, total %.1f ms\n",
+			   scenes[i].output_prefix.c_str(), (0 == result.status) ? "ok" : "FAILED", result.num_regions,
+			   result.load_ms, result.align_ms, result.segment_ms, result.fuse_ms, result.total_ms);
+	}
+	printf("%d scenes (%d failed) in %.2f s on %d threads: %.2f scenes/s\n", static_cast<int>(scenes.size()),
+		   failures, seconds, pool.num_threads(), (seconds > 0) ? scenes.size() / seconds : 0.0);
+
+	return (0 == failures) ? 0 : -1;
+}
 
 int main(int argc, char* argv[])
 {
 // check input parameters
-	if(argc != 3)
+	if(argc < 3)
 	{
 		std::cout << "Invalid parameters" << std::endl;
 		return -1;
 	}
+	const bool batch = ("--batch" == std::string(argv[1]));
+	int batch_threads = 0;
+	int tile_size = 0;
+	bool concurrent_merge = false;
+	FusionOptions fusion_options = GetDefaultFusionOptions();
+	std::vector<double> focus_distances;
+	std::string trace_file;
+	for (int arg_idx = 3; arg_idx < argc; ++arg_idx)
+	{
+		std::string option = argv[arg_idx];
+		if ("-v" == option && arg_idx + 1 < argc)
+		{
+			SetDiagLevel(atoi(argv[++arg_idx]));
+		}
+		else if ("--headless" == option)
+		{
+			SetDiagHeadless(true);
+		}
+		else if ("-t" == option && arg_idx + 1 < argc)
+		{
+			tile_size = atoi(argv[++arg_idx]);
+		}
+		else if ("--concurrent-merge" == option)
+		{
+			concurrent_merge = true;
+		}
+		else if ("-f" == option && arg_idx + 1 < argc)
+		{
+			fusion_options.focus_measure = atoi(argv[++arg_idx]);
+		}
+		else if ("-p" == option && arg_idx + 1 < argc)
+		{
+			fusion_options.coarse_level = atoi(argv[++arg_idx]);
+		}
+		else if ("-k" == option && arg_idx + 1 < argc)
+		{
+			fusion_options.top_k = atoi(argv[++arg_idx]);
+		}
+		else if ("-r" == option && arg_idx + 1 < argc)
+		{
+			fusion_options.retire_hysteresis = static_cast<float>(atof(argv[++arg_idx]));
+		}
+		else if ("--trace" == option && arg_idx + 1 < argc)
+		{
+			trace_file = argv[++arg_idx];
+		}
+		else if ("-j" == option && batch && arg_idx + 1 < argc)
+		{
+			batch_threads = atoi(argv[++arg_idx]);
+		}
+		else if ("-d" == option && !batch && arg_idx + 1 < argc)
+		{
+			if (0 != LoadFocusDistances(argv[++arg_idx], focus_distances))
+			{
+				std::cout << "Invalid focus distance file" << std::endl;
+				return -1;
+			}
+		}
+		else if ("-s" == option && !batch && arg_idx + 3 < argc)
+		{
+			const double near_distance = atof(argv[++arg_idx]);
+			const double far_distance = atof(argv[++arg_idx]);
+			MakeLinearFocusSweep(near_distance, far_distance, atoi(argv[++arg_idx]), focus_distances);
+		}
+		else
+		{
+			std::cout << "Invalid parameters" << std::endl;
+			return -1;
+		}
+	}
 
-// initialize the look up table for visualizing depth map 
-    InitializeDepthColorTable();
+// fuse every scene of a manifest
+	if (batch)
+	{
+		int batch_ret = RunBatch(argv[2], batch_threads, tile_size, concurrent_merge, fusion_options);
+		ReportInstrumentation(trace_file);
+		return batch_ret;
+	}
 
-// load depth map data from *.xml
+// load the 16-bit depth map, mapped from a depth file or parsed from *.xml
 	cv::Mat depth;
-	cv::FileStorage depth_data(argv[1], cv::FileStorage::READ);
-	depth_data["data"] >> depth;
-	//cv::flip(depth, depth, 1);
-	CV_Assert( depth.type() == CV_64FC1 );
-	depth.convertTo(depth, CV_16UC1);
+	DepthFile depth_file;
+	if (0 != LoadDepthMap(argv[1], depth_file, depth))
+	{
+		std::cout << "Invalid depth file" << std::endl;
+		return -1;
+	}
 
 // align depth map with color image
 	cv::Mat aligned_depth;
@@ -46,19 +220,35 @@ int main(int argc, char* argv[])
 	const double aperture_value = 4.0;
 	const double focal_length = 24;	
 	GraphBasedImageSeg* ptr_graph_based_seger = new GraphBasedImageSeg(coc_diameter, aperture_value, focal_length);
+	ptr_graph_based_seger->SetTileParallel(tile_size, concurrent_merge);
 	
-	// segment
-	aligned_depth.convertTo(aligned_depth, CV_64F);
+	// segment, the 16-bit depth is used as it is
 	cv::Mat dst_color;
 	int small_thresh = 10; // small components removing
-	std::vector<cv::Mat> segmented_regions;
-	int regions = ptr_graph_based_seger->GraphSegment(aligned_depth, small_thresh, segmented_regions, dst_color);
+	cv::Mat labels;
+	std::vector<RegionInfo> region_info;
+	int regions = ptr_graph_based_seger->GraphSegment(aligned_depth, small_thresh, labels, region_info, dst_color);
 	printf("Segmented regions: %d\n", regions);
-	cv::imwrite("segmentation_result.jpg", dst_color);
+	DiagWriteImage(DIAG_INFO, "segmentation_result.jpg", dst_color);
+
+// restrict the focus search of every region to the frames focused near its depth
+	if (!focus_distances.empty())
+	{
+		const int guide_margin = 1; // frames searched beyond the depth of field on both sides
+		cv::Mat mirrored_depth;
+		cv::flip(aligned_depth, mirrored_depth, 1); // labels are mirrored like the masks
+		std::vector<DepthRange> depth_ranges;
+		ComputeRegionDepthRanges(mirrored_depth, labels, regions, depth_ranges);
+		int full_search = ComputeFrameWindows(ptr_graph_based_seger->GetLensProfile(), focus_distances, depth_ranges,
+											  guide_margin, fusion_options.frame_window_first,
+											  fusion_options.frame_window_last);
+		printf("Depth guided search: %d of %d regions need the full search\n", full_search, regions);
+	}
 
 // construct all_in_focus image
 	cv::Mat all_in_focus_img;
-	int ret = ConstructAllInFocusImage(segmented_regions, argv[2], all_in_focus_img);
+	std::vector<int> best_frames;
+	int ret = ConstructAllInFocusImage(labels, regions, argv[2], fusion_options, all_in_focus_img, best_frames);
 	if(-1 == ret)
 	{
 		std::cout << "ConstructAllInFocusImage error" << std::endl;
@@ -71,6 +261,8 @@ int main(int argc, char* argv[])
 
 CLEAN_UP:
 	delete ptr_graph_based_seger;
+	DiagFlush();
+	ReportInstrumentation(trace_file);
 
 	return 0;
 }
\ No newline at end of file
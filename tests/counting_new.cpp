@@ -0,0 +1,37 @@
+/**
+* @file counting_new.cpp
+* @brief Replacement operator new that reports every allocation to the AllocationScope of
+*        the calling thread. Linked into the tests that measure allocations only, it lives
+*        in its own file so that the compiler can not inline it into the new expressions
+*/
+
+// System
+#include <cstdlib>
+#include <new>
+
+#include "frame_pool.h"
+
+/* ************************************************************************* */
+void* operator new(std::size_t size)
+{
+	CountAllocation();
+	for (;;) {
+		void* ptr = std::malloc(size ? size : 1);
+		if (ptr)
+		{
+			return ptr;
+		}
+		std::new_handler handler = std::get_new_handler();
+		if (!handler)
+		{
+			throw std::bad_alloc();
+		}
+		handler();
+	}
+}
+
+/* ************************************************************************* */
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
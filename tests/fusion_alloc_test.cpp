@@ -0,0 +1,264 @@
+/**
+* @file fusion_alloc_test.cpp
+* @brief Check that the fusion engine does not allocate once it is warmed up. Allocations
+*        are measured with AllocationScope, not taken from the frame pool. This file installs
+*        the hook that reports cv::Mat buffers to the scope, tests/counting_new.cpp the one
+*        of operator new
+*/
+
+// System
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+// OpenCV
+#include "opencv2/core/core.hpp"
+#include "opencv2/videoio.hpp"
+
+#include "focus_measure.h"
+#include "frame_pool.h"
+#include "fusion_engine.h"
+#include "work_stealing_pool.h"
+
+//usage: ./fusion_alloc_test [work_dir]
+//       returns 0 if every check passed
+
+static const int kWidth = 320;
+static const int kHeight = 240;
+static const int kFrames = 24;
+static const int kRegions = 12;
+
+#if CV_VERSION_MAJOR >= 4
+typedef cv::AccessFlag MatAccessFlag;
+#else
+typedef int MatAccessFlag;
+#endif
+
+/* ************************************************************************* */
+/**
+* @brief cv::Mat allocator that reports new buffers and leaves the work to the standard
+*        allocator. Mat buffers come from cv::fastMalloc, operator new never sees them
+*/
+class CountingMatAllocator : public cv::MatAllocator
+{
+public:
+	CountingMatAllocator() : std_allocator(cv::Mat::getStdAllocator()) {}
+
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+						   MatAccessFlag flags, cv::UMatUsageFlags usage_flags) const
+	{
+		if (!data)
+		{
+			CountAllocation();
+		}
+		return std_allocator->allocate(dims, sizes, type, data, step, flags, usage_flags);
+	}
+
+	bool allocate(cv::UMatData* data, MatAccessFlag access_flags, cv::UMatUsageFlags usage_flags) const
+	{
+		return std_allocator->allocate(data, access_flags, usage_flags);
+	}
+
+	void deallocate(cv::UMatData* data) const
+	{
+		std_allocator->deallocate(data);
+	}
+
+private:
+	cv::MatAllocator* std_allocator;
+};
+
+// the buffers it hands out belong to the standard allocator, so it only has to outlive
+// the time it is installed
+static CountingMatAllocator counting_mat_allocator;
+
+/* ************************************************************************* */
+/**
+* @brief:				write a short video whose frames are sharpest in different regions
+* @param  file_name:	video file
+* @return:				0 success; -1 failure
+*/
+static int WriteTestVideo(const std::string& file_name)
+{
+	cv::VideoWriter video(file_name, cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), 25, cv::Size(kWidth, kHeight));
+	if (!video.isOpened())
+	{
+		return -1;
+	}
+
+	cv::Mat frame(kHeight, kWidth, CV_8UC3);
+	srand(1);
+	for (int k = 0; k < kFrames; k++) {
+		for (int y = 0; y < kHeight; y++) {
+			cv::Vec3b* ptr_frame = frame.ptr<cv::Vec3b>(y);
+			for (int x = 0; x < kWidth; x++) {
+				const int contrast = ((x / 40 + k) % 8) * 16;
+				const uchar value = static_cast<uchar>(64 + ((x + y) % 2) * contrast + rand() % 8);
+				ptr_frame[x] = cv::Vec3b(value, value, value);
+			}
+		}
+		video << frame;
+	}
+
+	return 0;
+}
+
+/* ************************************************************************* */
+/**
+* @brief:				label map of kRegions blocks
+* @param  labels:		labels (CV_32SC1)
+*/
+static void MakeLabels(cv::Mat& labels)
+{
+	labels.create(kHeight, kWidth, CV_32SC1);
+	for (int y = 0; y < kHeight; y++) {
+		int* ptr_labels = labels.ptr<int>(y);
+		for (int x = 0; x < kWidth; x++) {
+			ptr_labels[x] = (y / (kHeight / 3)) * (kRegions / 3) + x / (kWidth / (kRegions / 3));
+		}
+	}
+	// a region too small for the pyramid level is measured at full resolution
+	labels(cv::Rect(5, 5, 2, 2)).setTo(kRegions - 1);
+}
+
+/* ************************************************************************* */
+/**
+* @brief:				run one engine over the test video
+* @param  video_file:	video file
+* @param  labels:		labels
+* @param  measure:		focus measure
+* @param  level:		pyramid level
+* @param  steady:		allocations after the warm-up
+* @return:				number of reduced frames; -1 failure
+*/
+static int RunEngine(const std::string& video_file, const cv::Mat& labels, const int measure, const int level,
+					 int64& steady)
+{
+	FusionEngine engine(2);
+	engine.SetFocusMeasure(measure);
+	engine.SetPyramidLevel(level);
+	std::vector<float> best(kRegions, 0.0f);
+	const int frames = engine.Run(video_file, labels, kRegions,
+		[&](const int frame_idx, const cv::Mat& frame, const std::vector<RegionStatistics>& stats)
+	{
+		(void)frame_idx;
+		(void)frame;
+		for (int i = 0; i < static_cast<int>(stats.size()); i++) {
+			best[i] = std::max(best[i], FocusScore(measure, stats[i]));
+		}
+		// the reducer is the caller's code, its allocations are not the engine's
+		std::vector<int> scratch(256);
+		return scratch.empty() ? -1 : 0;
+	});
+	steady = engine.steady_state_allocations();
+
+	return frames;
+}
+
+/* ************************************************************************* */
+int main(int argc, char* argv[])
+{
+	const std::string work_dir = (argc > 1) ? argv[1] : ".";
+	const std::string video_file = work_dir + "/fusion_alloc_test.avi";
+	int failures = 0;
+
+	cv::MatAllocator* default_mat_allocator = cv::Mat::getDefaultAllocator();
+	cv::Mat::setDefaultAllocator(&counting_mat_allocator);
+
+	// the scope has to see both kinds of allocations, otherwise a 0 below proves nothing
+	{
+		std::atomic<int64> counter(0);
+		{
+			AllocationScope scope(&counter);
+			std::vector<int> heap(64);
+			cv::Mat mat(16, 16, CV_8UC1);
+			heap[0] = mat.rows;
+		}
+		const bool ok = (counter.load() >= 2);
+		printf("%-40s %s (%lld allocations)\n", "scope counts new and cv::Mat", ok ? "ok" : "FAILED",
+			   static_cast<long long>(counter.load()));
+		failures += !ok;
+	}
+
+	if (0 != WriteTestVideo(video_file))
+	{
+		printf("Can not write %s\n", video_file.c_str());
+		cv::Mat::setDefaultAllocator(default_mat_allocator);
+		return -1;
+	}
+	cv::Mat labels;
+	MakeLabels(labels);
+
+	for (int measure = FOCUS_NORMALIZED_VARIANCE; measure <= FOCUS_SUM_MODIFIED_LAPLACIAN; measure++) {
+		for (int level = 0; level <= 1; level++) {
+			int64 steady = -1;
+			const int frames = RunEngine(video_file, labels, measure, level, steady);
+			const bool ok = (kFrames == frames && 0 == steady);
+			char name[64];
+			snprintf(name, sizeof(name), "measure %d, pyramid level %d", measure, level);
+			printf("%-40s %s (%d frames, %lld steady allocations)\n", name, ok ? "ok" : "FAILED", frames,
+				   static_cast<long long>(steady));
+			failures += !ok;
+		}
+	}
+
+	// engines running at the same time count only their own allocations, the thread that
+	// allocates all along must not show up in either of them
+	{
+		int64 steady[2] = { -1, -1 };
+		int frames[2] = { -1, -1 };
+		std::atomic<bool> running(true);
+		std::thread noise([&running]
+		{
+			while (running) {
+				std::vector<int> garbage(1024);
+				cv::Mat mat(32, 32, CV_8UC1);
+				garbage[0] = mat.cols;
+			}
+		});
+		std::thread first([&] { frames[0] = RunEngine(video_file, labels, FOCUS_TENENGRAD, 0, steady[0]); });
+		frames[1] = RunEngine(video_file, labels, FOCUS_NORMALIZED_VARIANCE, 1, steady[1]);
+		first.join();
+		running = false;
+		noise.join();
+
+		const bool ok = (kFrames == frames[0] && kFrames == frames[1] && 0 == steady[0] && 0 == steady[1]);
+		printf("%-40s %s (%lld and %lld steady allocations)\n", "concurrent engines", ok ? "ok" : "FAILED",
+			   static_cast<long long>(steady[0]), static_cast<long long>(steady[1]));
+		failures += !ok;
+	}
+
+	// engines running as tasks of a shared pool, as in a scene batch, queue their decoding and
+	// statistics on that pool. A single worker has to run all of them itself
+	for (int threads = 1; threads <= 2; threads++) {
+		int64 steady[3] = { -1, -1, -1 };
+		int frames[3] = { -1, -1, -1 };
+		{
+			WorkStealingPool pool(threads);
+			for (int k = 0; k < 3; k++) {
+				pool.Submit([&, k] { frames[k] = RunEngine(video_file, labels, k, k % 2, steady[k]); });
+			}
+			pool.Wait();
+		}
+
+		bool ok = true;
+		for (int k = 0; k < 3; k++) {
+			ok = ok && (kFrames == frames[k] && 0 == steady[k]);
+		}
+		char name[64];
+		snprintf(name, sizeof(name), "engines on a pool of %d", threads);
+		printf("%-40s %s (%lld, %lld and %lld steady allocations)\n", name, ok ? "ok" : "FAILED",
+			   static_cast<long long>(steady[0]), static_cast<long long>(steady[1]), static_cast<long long>(steady[2]));
+		failures += !ok;
+	}
+
+	remove(video_file.c_str());
+	cv::Mat::setDefaultAllocator(default_mat_allocator);
+	printf("%s\n", failures ? "FAILED" : "passed");
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,155 @@
+/**
+* @file reproject_test.cpp
+* @brief Check that DepthReprojector in REPROJECT_LAST_WRITE mode gives the depth map of the
+*        legacy per-pixel reprojection of AlignDepthWithColor bit for bit
+*/
+
+// System
+#include <cstdio>
+#include <cstdlib>
+
+// OpenCV
+#include "opencv2/core/core.hpp"
+
+#include "depth_reproject.h"
+
+//usage: ./reproject_test
+//       returns 0 if every check passed
+
+/* ************************************************************************* */
+/**
+* @brief:					the reprojection loop AlignDepthWithColor used before the tables, kept
+*							verbatim as the reference
+* @param  src_depth:		original depth map
+* @param  tmp_depth_for_color:	depth map seen from the color camera
+*/
+static void LegacyReproject(const cv::Mat& src_depth, cv::Mat& tmp_depth_for_color)
+{
+	// Pentax
+	static double pentax_fx = 810.1948;	static double pentax_fy = 814.2451;
+	static double pentax_u0 = 329.0910;	static double pentax_v0 = 244.0002;
+	// Kinect
+	static double kinect_fx = 583.9147;	static double kinect_fy = 586.7294;
+	static double kinect_u0 = 328.9980;	static double kinect_v0 = 251.6837;
+	// extrinsic parameters
+	static cv::Mat rotation_matrix = (cv::Mat_<double>(3, 3) << 0.9997,		0.0200,		0.0158,
+														-0.0200,	0.9998,		0.0035,
+														-0.0157,	-0.0038,	0.9999);
+	static cv::Mat translation_matrix = (cv::Mat_<double>(3, 1) << 10, 53.8973, 40.4947);
+	int depth_map_height = src_depth.rows;
+	int depth_map_width = src_depth.cols;
+
+	tmp_depth_for_color = cv::Mat::zeros(depth_map_height, depth_map_width, CV_16UC1);
+
+	for (int row_idx = 0; row_idx < depth_map_height; ++row_idx)
+	{
+		const ushort* ptr_raw_depth_img = src_depth.ptr<ushort>(row_idx);
+
+		for (int col_idx = 0; col_idx < depth_map_width; ++col_idx)
+		{
+			double raw_depth_value = static_cast<double>(ptr_raw_depth_img[col_idx]);
+			const double z_kinect = raw_depth_value;
+			const double x_kinect = (col_idx - kinect_u0) * z_kinect / kinect_fx;
+			const double y_kinect = (row_idx - kinect_v0) * z_kinect / kinect_fy;
+
+			cv::Mat xyz_kinect = (cv::Mat_<double>(3, 1) << x_kinect, y_kinect, z_kinect);
+
+			cv::Mat xyz_pentax = rotation_matrix * xyz_kinect + translation_matrix;
+
+			const double z_pentax = xyz_pentax.at<double>(2, 0);
+			const double x_pentax = xyz_pentax.at<double>(0, 0);
+			const double y_pentax = xyz_pentax.at<double>(1, 0);
+
+			double tmp_pentax_col_idx = (x_pentax / z_pentax) * pentax_fx + pentax_u0;
+			double tmp_pentax_row_idx = (y_pentax / z_pentax) * pentax_fy + pentax_v0;
+
+			int pentax_col_idx = static_cast<int>(tmp_pentax_col_idx + 0.5);
+			int pentax_row_idx = static_cast<int>(tmp_pentax_row_idx + 0.5);
+			if (pentax_col_idx < 0)	pentax_col_idx = 0;
+			if (pentax_col_idx >= depth_map_width) pentax_col_idx = (depth_map_width - 1);
+
+			if (pentax_row_idx < 0)	pentax_row_idx = 0;
+			if (pentax_row_idx >= depth_map_height) pentax_row_idx = (depth_map_height - 1);
+
+			// obtain depth value for color
+			ushort* ptr_tmp_depth_for_color = tmp_depth_for_color.ptr<ushort>(pentax_row_idx);
+			ptr_tmp_depth_for_color[pentax_col_idx] = z_pentax;
+		}
+	}
+}
+
+/* ************************************************************************* */
+/**
+* @brief:				synthetic depth map: tilted planes with holes, or uniform noise over the
+*						whole 16-bit range
+* @param  size:			map size
+* @param  kind:			0 planes; 1 noise
+* @param  depth:		depth map (CV_16UC1)
+*/
+static void MakeDepth(const cv::Size& size, const int kind, cv::Mat& depth)
+{
+	depth.create(size, CV_16UC1);
+	for (int y = 0; y < size.height; y++) {
+		ushort* ptr_depth = depth.ptr<ushort>(y);
+		for (int x = 0; x < size.width; x++) {
+			if (1 == kind)
+			{
+				ptr_depth[x] = static_cast<ushort>(rand() & 0xffff);
+			}
+			else if (0 == rand() % 16)
+			{
+				ptr_depth[x] = 0;
+			}
+			else
+			{
+				const int plane = (x * 4 / size.width) + 4 * (y * 3 / size.height);
+				ptr_depth[x] = static_cast<ushort>(600 + 250 * plane + (x + 2 * y) % 97 + rand() % 3);
+			}
+		}
+	}
+}
+
+/* ************************************************************************* */
+int main(int argc, char* argv[])
+{
+	(void)argc;
+	(void)argv;
+
+	// odd widths run the scalar tail next to the two-pixel SSE2 steps
+	const cv::Size sizes[] = { cv::Size(640, 480), cv::Size(641, 479), cv::Size(97, 61) };
+	int failures = 0;
+	DepthReprojector reprojector(GetDefaultRigCalibration());
+	srand(7);
+
+	for (int i = 0; i < static_cast<int>(sizeof(sizes) / sizeof(sizes[0])); i++) {
+		for (int kind = 0; kind <= 1; kind++) {
+			for (int frame = 0; frame < 3; frame++) {
+				cv::Mat depth, expected, actual;
+				MakeDepth(sizes[i], kind, depth);
+				LegacyReproject(depth, expected);
+				if (0 != reprojector.Reproject(depth, actual, REPROJECT_LAST_WRITE))
+				{
+					printf("%dx%d: Reproject failed\n", sizes[i].width, sizes[i].height);
+					failures++;
+					continue;
+				}
+
+				int differing = 0;
+				for (int y = 0; y < depth.rows; y++) {
+					for (int x = 0; x < depth.cols; x++) {
+						differing += (expected.at<ushort>(y, x) != actual.at<ushort>(y, x));
+					}
+				}
+				char name[64];
+				snprintf(name, sizeof(name), "%dx%d %s, frame %d", sizes[i].width, sizes[i].height,
+						 kind ? "noise" : "planes", frame);
+				printf("%-40s %s (%d differing pixels)\n", name, differing ? "FAILED" : "ok", differing);
+				failures += (0 != differing);
+			}
+		}
+	}
+
+	printf("%s\n", failures ? "FAILED" : "passed");
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,124 @@
+/**
+* @file segment_dof_test.cpp
+* @brief Check that every region of the tile-parallel segmentation of a 4K depth map satisfies
+*        the depth of field criterion of the merge, with the serial and with the concurrent
+*        stitch
+*/
+
+// System
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// OpenCV
+#include "opencv2/core/core.hpp"
+
+#include "lens.h"
+#include "segment.h"
+#include "work_stealing_pool.h"
+
+//usage: ./segment_dof_test [threads]
+//       returns 0 if every check passed
+
+// lens of the default segmenter
+static const double coc_diameter = 0.019;
+static const double aperture_value = 4.0;
+static const double focal_length = 24.0;
+
+/* ************************************************************************* */
+/**
+* @brief:				synthetic 4K depth map: long ramps whose depth range exceeds the depth of
+*						field, so that the criterion decides where regions end, with noise on top
+* @param  depth:		depth map (CV_16UC1)
+*/
+static void MakeDepth(cv::Mat& depth)
+{
+	depth.create(2160, 3840, CV_16UC1);
+	srand(11);
+	for (int y = 0; y < depth.rows; y++) {
+		ushort* ptr_depth = depth.ptr<ushort>(y);
+		for (int x = 0; x < depth.cols; x++) {
+			const int band = y / 135;
+			ptr_depth[x] = static_cast<ushort>(500 + 200 * band + (x * (band % 4 + 1)) / 2 + rand() % 4);
+		}
+	}
+}
+
+/* ************************************************************************* */
+/**
+* @brief:				count the regions whose depth range breaks the merge criterion
+* @param  depth:		depth map
+* @param  labels:		labels of the depth map, mirrored horizontally
+* @param  num_regions:	number of regions
+* @param  dof_table:	depth of field tables of the lens
+* @return:				number of violating regions
+*/
+static int CountDofViolations(const cv::Mat& depth, const cv::Mat& labels, const int num_regions,
+							  const DofTable& dof_table)
+{
+	std::vector<int> minimum(num_regions, USHRT_MAX);
+	std::vector<int> maximum(num_regions, 0);
+	for (int y = 0; y < depth.rows; y++) {
+		const ushort* ptr_depth = depth.ptr<ushort>(y);
+		const int* ptr_labels = labels.ptr<int>(y);
+		for (int x = 0; x < depth.cols; x++) {
+			const int label = ptr_labels[depth.cols - 1 - x];
+			minimum[label] = std::min(minimum[label], static_cast<int>(ptr_depth[x]));
+			maximum[label] = std::max(maximum[label], static_cast<int>(ptr_depth[x]));
+		}
+	}
+
+	int violations = 0;
+	for (int i = 0; i < num_regions; i++) {
+		// the predicate of GraphBasedImageSeg::WithinDof
+		const double diff = maximum[i] - minimum[i];
+		if (!(diff < dof_table.back(minimum[i])) && !(diff < dof_table.front(maximum[i])))
+		{
+			violations++;
+		}
+	}
+
+	return violations;
+}
+
+/* ************************************************************************* */
+int main(int argc, char* argv[])
+{
+	const int threads = (argc > 1) ? atoi(argv[1]) : 8;
+	int failures = 0;
+
+	cv::Mat depth;
+	MakeDepth(depth);
+	DofTable dof_table;
+	dof_table.Build(MakeLensProfile(coc_diameter, aperture_value, focal_length));
+
+	for (int concurrent = 0; concurrent <= 1; concurrent++) {
+		int num_regions = -1;
+		cv::Mat labels, dst;
+		std::vector<RegionInfo> region_info;
+		{
+			// the stages run their parallel loops on the pool of the task that calls them
+			WorkStealingPool pool(threads);
+			pool.Submit([&]
+			{
+				GraphBasedImageSeg seger(coc_diameter, aperture_value, focal_length);
+				seger.SetTileParallel(256, 0 != concurrent);
+				// no small region merging, it ignores the criterion on purpose
+				num_regions = seger.GraphSegment(depth, 0, labels, region_info, dst);
+			});
+			pool.Wait();
+		}
+
+		const int violations = (num_regions > 0) ? CountDofViolations(depth, labels, num_regions, dof_table) : -1;
+		const bool ok = (num_regions > 0 && 0 == violations);
+		printf("%-40s %s (%d regions, %d outside the depth of field)\n",
+			   concurrent ? "4K, concurrent stitch" : "4K, serial stitch", ok ? "ok" : "FAILED",
+			   num_regions, violations);
+		failures += !ok;
+	}
+
+	printf("%s\n", failures ? "FAILED" : "passed");
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,96 @@
+/**
+* @file depth_convert.cpp
+* @brief Convert FileStorage XML depth maps into a binary depth file
+*/
+
+// System
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// OpenCV
+#include "opencv2/core/core.hpp"
+
+#include "depth_io.h"
+
+//usage: ./depth_convert depth.dpth depth_data.xml [depth_data.xml ...]
+//       every XML file holds one depth map (mm) under "data", it becomes one frame of the output.
+//       Depth must be integral in [0, 65535] so that the 16-bit file is lossless
+
+/* ************************************************************************* */
+/**
+* @brief:                       load a FileStorage depth map and convert it to 16 bits
+* @param  file_name:            XML file
+* @param  depth:                depth map (CV_16UC1)
+* @return:                      0 success; 1 failure
+*/
+static int LoadXmlDepth(const std::string& file_name, cv::Mat& depth)
+{
+	cv::Mat data;
+	cv::FileStorage depth_data(file_name, cv::FileStorage::READ);
+	if (!depth_data.isOpened())
+	{
+		printf("Cannot open %s\n", file_name.c_str());
+		return 1;
+	}
+	depth_data["data"] >> data;
+	if (data.empty() || 1 != data.channels())
+	{
+		printf("%s holds no single channel depth map\n", file_name.c_str());
+		return 1;
+	}
+	data.convertTo(data, CV_64F);
+
+	for (int y = 0; y < data.rows; y++)
+	{
+		const double* ptr_data = data.ptr<double>(y);
+		for (int x = 0; x < data.cols; x++)
+		{
+			if (!(ptr_data[x] >= 0 && ptr_data[x] <= USHRT_MAX) || ptr_data[x] != floor(ptr_data[x]))
+			{
+				printf("%s: depth %f at (%d, %d) does not fit into 16 bits\n", file_name.c_str(), ptr_data[x], x, y);
+				return 1;
+			}
+		}
+	}
+	data.convertTo(depth, CV_16UC1);
+
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		printf("usage: %s depth.dpth depth_data.xml [depth_data.xml ...]\n", argv[0]);
+		return -1;
+	}
+
+	std::vector<cv::Mat> frames;
+	for (int arg_idx = 2; arg_idx < argc; ++arg_idx)
+	{
+		cv::Mat depth;
+		if (0 != LoadXmlDepth(argv[arg_idx], depth))
+		{
+			return -1;
+		}
+		if (!frames.empty() && depth.size() != frames[0].size())
+		{
+			printf("%s: size differs from the first depth map\n", argv[arg_idx]);
+			return -1;
+		}
+		frames.push_back(depth);
+	}
+
+	if (0 != WriteDepthFile(argv[1], frames))
+	{
+		printf("Cannot write %s\n", argv[1]);
+		return -1;
+	}
+	printf("%d frame(s) of %dx%d written to %s\n", static_cast<int>(frames.size()), frames[0].cols,
+		   frames[0].rows, argv[1]);
+
+	return 0;
+}